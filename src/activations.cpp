@@ -1,155 +1,351 @@
 #include "activations.h"
+#include "simd.h"
+#include "threads.h"
 #include <cmath>
+#include <algorithm>
+#include <stdexcept>
 
 namespace litenet::activations {
     double sigmoid(double x) {
         return 1 / (1 + exp(-x));
     }
 
-    Matrix sigmoid(const Matrix &m) {
-        Matrix result(m.getRows(), m.getCols());
-        for (int i = 0; i < m.getRows(); i++) {
-            for (int j = 0; j < m.getCols(); j++) {
-                result(i, j) = sigmoid(m(i, j));
-            }
-        }
+    template <typename T>
+    BasicMatrix<T> sigmoid(const BasicMatrix<T> &m) {
+        BasicMatrix<T> result;
+        sigmoid(m, result);
         return result;
     }
 
-    Matrix sigmoidPrime(const Matrix &m) {
-        Matrix result(m.getRows(), m.getCols());
-        for (int i = 0; i < m.getRows(); i++) {
-            for (int j = 0; j < m.getCols(); j++) {
-                double s = sigmoid(m(i, j));
-                result(i, j) = s * (1 - s);
-            }
-        }
+    template <typename T>
+    BasicMatrix<T> sigmoidPrime(const BasicMatrix<T> &m) {
+        BasicMatrix<T> result;
+        sigmoidPrime(m, result);
         return result;
     }
 
+    template <typename T>
+    void sigmoid(const BasicMatrix<T> &m, BasicMatrix<T> &out) {
+        out.resize(m.getRows(), m.getCols());
+        const T *in = m.getData();
+        T *result = out.getData();
+        threads::parallelFor(m.getSize(), threads::grain, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) {
+                result[i] = 1 / (1 + std::exp(-in[i]));
+            }
+        });
+    }
+
+    template <typename T>
+    void sigmoidPrime(const BasicMatrix<T> &m, BasicMatrix<T> &out) {
+        out.resize(m.getRows(), m.getCols());
+        const T *in = m.getData();
+        T *result = out.getData();
+        threads::parallelFor(m.getSize(), threads::grain, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) {
+                T s = 1 / (1 + std::exp(-in[i]));
+                result[i] = s * (1 - s);
+            }
+        });
+    }
+
     double relu(double x) {
         return x > 0 ? x : 0;
     }
 
-    Matrix relu(const Matrix &m) {
-        Matrix result(m.getRows(), m.getCols());
-        for (int i = 0; i < m.getRows(); i++) {
-            for (int j = 0; j < m.getCols(); j++) {
-                result(i, j) = relu(m(i, j));
-            }
-        }
+    template <typename T>
+    BasicMatrix<T> relu(const BasicMatrix<T> &m) {
+        BasicMatrix<T> result;
+        relu(m, result);
         return result;
     }
 
-    Matrix reluPrime(const Matrix &m) {
-        Matrix result(m.getRows(), m.getCols());
-        for (int i = 0; i < m.getRows(); i++) {
-            for (int j = 0; j < m.getCols(); j++) {
-                result(i, j) = m(i, j) > 0 ? 1 : 0;
-            }
-        }
+    template <typename T>
+    BasicMatrix<T> reluPrime(const BasicMatrix<T> &m) {
+        BasicMatrix<T> result;
+        reluPrime(m, result);
         return result;
     }
 
+    template <typename T>
+    void relu(const BasicMatrix<T> &m, BasicMatrix<T> &out) {
+        out.resize(m.getRows(), m.getCols());
+        const T *in = m.getData();
+        T *result = out.getData();
+        threads::parallelFor(m.getSize(), threads::grain, [&](size_t begin, size_t end) {
+            simd::kernels<T>().relu(in + begin, result + begin, end - begin);
+        });
+    }
+
+    template <typename T>
+    void reluPrime(const BasicMatrix<T> &m, BasicMatrix<T> &out) {
+        out.resize(m.getRows(), m.getCols());
+        const T *in = m.getData();
+        T *result = out.getData();
+        threads::parallelFor(m.getSize(), threads::grain, [&](size_t begin, size_t end) {
+            simd::kernels<T>().reluPrime(in + begin, result + begin, end - begin);
+        });
+    }
+
     double leakyRelu(double x, double negativeSlope) {
         return x > 0 ? x : negativeSlope * x;
     }
 
-    Matrix leakyRelu(const Matrix &m, double negativeSlope) {
-        Matrix result(m.getRows(), m.getCols());
-        for (int i = 0; i < m.getRows(); i++) {
-            for (int j = 0; j < m.getCols(); j++) {
-                result(i, j) = leakyRelu(m(i, j), negativeSlope);
-            }
-        }
+    template <typename T>
+    BasicMatrix<T> leakyRelu(const BasicMatrix<T> &m, double negativeSlope) {
+        BasicMatrix<T> result;
+        leakyRelu(m, result, negativeSlope);
         return result;
     }
 
-    Matrix leakyReluPrime(const Matrix &m, double negativeSlope) {
-        Matrix result(m.getRows(), m.getCols());
-        for (int i = 0; i < m.getRows(); i++) {
-            for (int j = 0; j < m.getCols(); j++) {
-                result(i, j) = m(i, j) > 0 ? 1 : negativeSlope;
-            }
-        }
+    template <typename T>
+    BasicMatrix<T> leakyReluPrime(const BasicMatrix<T> &m, double negativeSlope) {
+        BasicMatrix<T> result;
+        leakyReluPrime(m, result, negativeSlope);
         return result;
     }
 
-    Matrix tanh(const Matrix &m) {
-        Matrix result(m.getRows(), m.getCols());
-        for (int i = 0; i < m.getRows(); i++) {
-            for (int j = 0; j < m.getCols(); j++) {
-                result(i, j) = std::tanh(m(i, j));
-            }
-        }
+    template <typename T>
+    void leakyRelu(const BasicMatrix<T> &m, BasicMatrix<T> &out, double negativeSlope) {
+        out.resize(m.getRows(), m.getCols());
+        const T *in = m.getData();
+        T *result = out.getData();
+        threads::parallelFor(m.getSize(), threads::grain, [&](size_t begin, size_t end) {
+            simd::kernels<T>().leakyRelu(in + begin, negativeSlope, result + begin, end - begin);
+        });
+    }
+
+    template <typename T>
+    void leakyReluPrime(const BasicMatrix<T> &m, BasicMatrix<T> &out, double negativeSlope) {
+        out.resize(m.getRows(), m.getCols());
+        const T *in = m.getData();
+        T *result = out.getData();
+        threads::parallelFor(m.getSize(), threads::grain, [&](size_t begin, size_t end) {
+            simd::kernels<T>().leakyReluPrime(in + begin, negativeSlope, result + begin, end - begin);
+        });
+    }
+
+    template <typename T>
+    BasicMatrix<T> tanh(const BasicMatrix<T> &m) {
+        BasicMatrix<T> result;
+        tanh(m, result);
         return result;
     }
 
-    Matrix tanhPrime(const Matrix &m) {
-        Matrix result(m.getRows(), m.getCols());
-        for (int i = 0; i < m.getRows(); i++) {
-            for (int j = 0; j < m.getCols(); j++) {
-                double t = std::tanh(m(i, j));
-                result(i, j) = 1 - t * t;
-            }
-        }
+    template <typename T>
+    BasicMatrix<T> tanhPrime(const BasicMatrix<T> &m) {
+        BasicMatrix<T> result;
+        tanhPrime(m, result);
         return result;
     }
 
-    Matrix softmax(const Matrix &m) {
-        Matrix result(m.getRows(), m.getCols());
-        for (int i = 0; i < m.getRows(); i++) {
-            double max = m(i, 0); // find max value in row
-            for (int j = 1; j < m.getCols(); j++) {
-                if (m(i, j) > max) {
-                    max = m(i, j);
-                }
-            }
-            double sum = 0; // compute sum of exponential
-            for (int j = 0; j < m.getCols(); j++) {
-                result(i, j) = exp(m(i, j) - max);
-                sum += result(i, j);
+    template <typename T>
+    void tanh(const BasicMatrix<T> &m, BasicMatrix<T> &out) {
+        out.resize(m.getRows(), m.getCols());
+        const T *in = m.getData();
+        T *result = out.getData();
+        threads::parallelFor(m.getSize(), threads::grain, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) {
+                result[i] = std::tanh(in[i]);
             }
+        });
+    }
 
-            for (int j = 0; j < m.getCols(); j++) {
-                result(i, j) /= sum;
+    template <typename T>
+    void tanhPrime(const BasicMatrix<T> &m, BasicMatrix<T> &out) {
+        out.resize(m.getRows(), m.getCols());
+        const T *in = m.getData();
+        T *result = out.getData();
+        threads::parallelFor(m.getSize(), threads::grain, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) {
+                T t = std::tanh(in[i]);
+                result[i] = 1 - t * t;
             }
-        }
+        });
+    }
+
+    template <typename T>
+    BasicMatrix<T> softmax(const BasicMatrix<T> &m) {
+        BasicMatrix<T> result;
+        softmax(m, result);
         return result;
     }
 
-    Matrix softmaxPrime(const Matrix &m) {
-        Matrix result(m.getRows(), m.getCols());
-        for (int i = 0; i < m.getRows(); i++) {
-            double max = m(i, 0); // find max value in row
-            for (int j = 1; j < m.getCols(); j++) {
-                if (m(i, j) > max) {
-                    max = m(i, j);
-                }
-            }
-            double sum = 0; // compute sum of exponential
-            for (int j = 0; j < m.getCols(); j++) {
-                result(i, j) = exp(m(i, j) - max);
-                sum += result(i, j);
-            }
-            for (int j = 0; j < m.getCols(); j++) {
-                result(i, j) /= sum;
-                result(i, j) *= (1 - result(i, j)); // softmax prime is softmax * (1 - softmax)
+    template <typename T>
+    BasicMatrix<T> softmaxPrime(const BasicMatrix<T> &m) {
+        BasicMatrix<T> result;
+        softmaxPrime(m, result);
+        return result;
+    }
+
+    template <typename T>
+    void softmax(const BasicMatrix<T> &m, BasicMatrix<T> &out) {
+        out.resize(m.getRows(), m.getCols());
+        const simd::Kernels<T> &kernels = simd::kernels<T>();
+        int cols = m.getCols();
+        threads::parallelForRows(m.getRows(), cols, [&](int i) {
+            const T *in = m.getData() + i * cols;
+            T *result = out.getData() + i * cols;
+            T max = kernels.max(in, cols); // find max value in row
+            for (int j = 0; j < cols; j++) { // compute exponentials
+                result[j] = std::exp(in[j] - max);
             }
+            kernels.divScalar(result, kernels.sum(result, cols), result, cols);
+        });
+    }
+
+    template <typename T>
+    void softmaxPrime(const BasicMatrix<T> &m, BasicMatrix<T> &out) {
+        softmax(m, out);
+        T *result = out.getData();
+        for (size_t i = 0; i < out.getSize(); i++) {
+            result[i] *= (1 - result[i]); // softmax prime is softmax * (1 - softmax)
         }
-        return result;
     }
 
     double linear(double x) {
         return x;
     }
 
-    Matrix linear(const Matrix &m) {
+    template <typename T>
+    BasicMatrix<T> linear(const BasicMatrix<T> &m) {
         return m;
     }
 
-    Matrix linearPrime(const Matrix &m) {
-        Matrix result(m.getRows(), m.getCols(), 1);
+    template <typename T>
+    BasicMatrix<T> linearPrime(const BasicMatrix<T> &m) {
+        BasicMatrix<T> result(m.getRows(), m.getCols(), 1);
         return result;
     }
+
+    template <typename T>
+    void linear(const BasicMatrix<T> &m, BasicMatrix<T> &out) {
+        out = m;
+    }
+
+    template <typename T>
+    void linearPrime(const BasicMatrix<T> &m, BasicMatrix<T> &out) {
+        out.resize(m.getRows(), m.getCols());
+        out.fill(1);
+    }
+
+    Activation fromName(const std::string &name) {
+        if (name == "linear") {
+            return Activation::Linear;
+        } else if (name == "sigmoid") {
+            return Activation::Sigmoid;
+        } else if (name == "relu") {
+            return Activation::Relu;
+        } else if (name == "leakyRelu") {
+            return Activation::LeakyRelu;
+        } else if (name == "tanh") {
+            return Activation::Tanh;
+        } else if (name == "softmax") {
+            return Activation::Softmax;
+        }
+        throw std::invalid_argument("unknown activation function: " + name);
+    }
+
+    template <typename T>
+    void biasActivation(Activation activation, const T *bias, T *c, int ld, int rows, int cols, double negativeSlope) {
+        const simd::Kernels<T> &kernels = simd::kernels<T>();
+        for (int i = 0; i < rows; i++) {
+            T *row = c + static_cast<size_t>(i) * ld;
+            if (bias) {
+                kernels.add(row, bias, row, cols);
+            }
+            switch (activation) {
+                case Activation::Linear:
+                    break;
+                case Activation::Sigmoid:
+                    for (int j = 0; j < cols; j++) {
+                        row[j] = 1 / (1 + std::exp(-row[j]));
+                    }
+                    break;
+                case Activation::Relu:
+                    kernels.relu(row, row, cols);
+                    break;
+                case Activation::LeakyRelu:
+                    kernels.leakyRelu(row, negativeSlope, row, cols);
+                    break;
+                case Activation::Tanh:
+                    for (int j = 0; j < cols; j++) {
+                        row[j] = std::tanh(row[j]);
+                    }
+                    break;
+                case Activation::Softmax: {
+                    T max = kernels.max(row, cols);
+                    for (int j = 0; j < cols; j++) {
+                        row[j] = std::exp(row[j] - max);
+                    }
+                    kernels.divScalar(row, kernels.sum(row, cols), row, cols);
+                    break;
+                }
+            }
+        }
+    }
+
+    template <typename T>
+    void activationPrimeProduct(Activation activation, const T *y, const T *dOutput, T *delta, size_t n, double negativeSlope) {
+        T slope = static_cast<T>(negativeSlope);
+        threads::parallelFor(n, threads::grain, [&](size_t begin, size_t end) {
+            switch (activation) {
+                case Activation::Linear:
+                    std::copy(dOutput + begin, dOutput + end, delta + begin);
+                    break;
+                case Activation::Sigmoid:
+                case Activation::Softmax:
+                    for (size_t i = begin; i < end; i++) {
+                        delta[i] = dOutput[i] * y[i] * (1 - y[i]);
+                    }
+                    break;
+                case Activation::Relu: // y > 0 exactly where z > 0
+                    for (size_t i = begin; i < end; i++) {
+                        delta[i] = y[i] > 0 ? dOutput[i] : 0;
+                    }
+                    break;
+                case Activation::LeakyRelu: // a positive slope keeps the sign of z
+                    for (size_t i = begin; i < end; i++) {
+                        delta[i] = y[i] > 0 ? dOutput[i] : slope * dOutput[i];
+                    }
+                    break;
+                case Activation::Tanh:
+                    for (size_t i = begin; i < end; i++) {
+                        delta[i] = dOutput[i] * (1 - y[i] * y[i]);
+                    }
+                    break;
+            }
+        });
+    }
+
+    #define LITENET_INSTANTIATE(T) \
+        template BasicMatrix<T> sigmoid(const BasicMatrix<T> &); \
+        template BasicMatrix<T> sigmoidPrime(const BasicMatrix<T> &); \
+        template void sigmoid(const BasicMatrix<T> &, BasicMatrix<T> &); \
+        template void sigmoidPrime(const BasicMatrix<T> &, BasicMatrix<T> &); \
+        template BasicMatrix<T> relu(const BasicMatrix<T> &); \
+        template BasicMatrix<T> reluPrime(const BasicMatrix<T> &); \
+        template void relu(const BasicMatrix<T> &, BasicMatrix<T> &); \
+        template void reluPrime(const BasicMatrix<T> &, BasicMatrix<T> &); \
+        template BasicMatrix<T> leakyRelu(const BasicMatrix<T> &, double); \
+        template BasicMatrix<T> leakyReluPrime(const BasicMatrix<T> &, double); \
+        template void leakyRelu(const BasicMatrix<T> &, BasicMatrix<T> &, double); \
+        template void leakyReluPrime(const BasicMatrix<T> &, BasicMatrix<T> &, double); \
+        template BasicMatrix<T> tanh(const BasicMatrix<T> &); \
+        template BasicMatrix<T> tanhPrime(const BasicMatrix<T> &); \
+        template void tanh(const BasicMatrix<T> &, BasicMatrix<T> &); \
+        template void tanhPrime(const BasicMatrix<T> &, BasicMatrix<T> &); \
+        template BasicMatrix<T> softmax(const BasicMatrix<T> &); \
+        template BasicMatrix<T> softmaxPrime(const BasicMatrix<T> &); \
+        template void softmax(const BasicMatrix<T> &, BasicMatrix<T> &); \
+        template void softmaxPrime(const BasicMatrix<T> &, BasicMatrix<T> &); \
+        template BasicMatrix<T> linear(const BasicMatrix<T> &); \
+        template BasicMatrix<T> linearPrime(const BasicMatrix<T> &); \
+        template void linear(const BasicMatrix<T> &, BasicMatrix<T> &); \
+        template void linearPrime(const BasicMatrix<T> &, BasicMatrix<T> &); \
+        template void biasActivation(Activation, const T *, T *, int, int, int, double); \
+        template void activationPrimeProduct(Activation, const T *, const T *, T *, size_t, double);
+    LITENET_INSTANTIATE(double)
+    LITENET_INSTANTIATE(float)
+    #undef LITENET_INSTANTIATE
 }
\ No newline at end of file
@@ -3,29 +3,83 @@
 
 #include "matrix.h"
 #include <vector>
+#include <string>
 
+// Every activation also has an out-parameter overload that writes into a reusable buffer
+// Matrix overloads are instantiated for float and double
 namespace litenet::activations {
     double sigmoid(double x);
-    Matrix sigmoid(const Matrix &m);
-    Matrix sigmoidPrime(const Matrix &m);
+    template <typename T>
+    BasicMatrix<T> sigmoid(const BasicMatrix<T> &m);
+    template <typename T>
+    BasicMatrix<T> sigmoidPrime(const BasicMatrix<T> &m);
+    template <typename T>
+    void sigmoid(const BasicMatrix<T> &m, BasicMatrix<T> &out);
+    template <typename T>
+    void sigmoidPrime(const BasicMatrix<T> &m, BasicMatrix<T> &out);
 
     double relu(double x);
-    Matrix relu(const Matrix &m);
-    Matrix reluPrime(const Matrix &m);
+    template <typename T>
+    BasicMatrix<T> relu(const BasicMatrix<T> &m);
+    template <typename T>
+    BasicMatrix<T> reluPrime(const BasicMatrix<T> &m);
+    template <typename T>
+    void relu(const BasicMatrix<T> &m, BasicMatrix<T> &out);
+    template <typename T>
+    void reluPrime(const BasicMatrix<T> &m, BasicMatrix<T> &out);
 
     double leakyRelu(double x, double negativeSlope = 0.2);
-    Matrix leakyRelu(const Matrix &m, double negativeSlope = 0.2);
-    Matrix leakyReluPrime(const Matrix &m, double negativeSlope = 0.2);
+    template <typename T>
+    BasicMatrix<T> leakyRelu(const BasicMatrix<T> &m, double negativeSlope = 0.2);
+    template <typename T>
+    BasicMatrix<T> leakyReluPrime(const BasicMatrix<T> &m, double negativeSlope = 0.2);
+    template <typename T>
+    void leakyRelu(const BasicMatrix<T> &m, BasicMatrix<T> &out, double negativeSlope = 0.2);
+    template <typename T>
+    void leakyReluPrime(const BasicMatrix<T> &m, BasicMatrix<T> &out, double negativeSlope = 0.2);
 
-    Matrix tanh(const Matrix &m);
-    Matrix tanhPrime(const Matrix &m);
+    template <typename T>
+    BasicMatrix<T> tanh(const BasicMatrix<T> &m);
+    template <typename T>
+    BasicMatrix<T> tanhPrime(const BasicMatrix<T> &m);
+    template <typename T>
+    void tanh(const BasicMatrix<T> &m, BasicMatrix<T> &out);
+    template <typename T>
+    void tanhPrime(const BasicMatrix<T> &m, BasicMatrix<T> &out);
 
-    Matrix softmax(const Matrix &m);
-    Matrix softmaxPrime(const Matrix &m);
+    template <typename T>
+    BasicMatrix<T> softmax(const BasicMatrix<T> &m);
+    template <typename T>
+    BasicMatrix<T> softmaxPrime(const BasicMatrix<T> &m);
+    template <typename T>
+    void softmax(const BasicMatrix<T> &m, BasicMatrix<T> &out);
+    template <typename T>
+    void softmaxPrime(const BasicMatrix<T> &m, BasicMatrix<T> &out);
 
     double linear(double x);    
-    Matrix linear(const Matrix &m);
-    Matrix linearPrime(const Matrix &m);
+    template <typename T>
+    BasicMatrix<T> linear(const BasicMatrix<T> &m);
+    template <typename T>
+    BasicMatrix<T> linearPrime(const BasicMatrix<T> &m);
+    template <typename T>
+    void linear(const BasicMatrix<T> &m, BasicMatrix<T> &out);
+    template <typename T>
+    void linearPrime(const BasicMatrix<T> &m, BasicMatrix<T> &out);
+
+    // Activations by kind, for layers that resolve the activation name once instead of on every call
+    enum class Activation { Linear, Sigmoid, Relu, LeakyRelu, Tanh, Softmax };
+    Activation fromName(const std::string &name); // throws std::invalid_argument for unknown names
+
+    // Fused kernels used by Dense
+    // c = activation(c + bias) on a rows x cols block whose rows are ld elements apart, with bias indexed
+    // by column (or no bias when it is null); softmax normalizes each row of the block, so the block must
+    // span whole rows
+    template <typename T>
+    void biasActivation(Activation activation, const T *bias, T *c, int ld, int rows, int cols, double negativeSlope = 0.2);
+    // delta = dOutput * activation'(z) over n elements, computed from the output y = activation(z)
+    // instead of z; softmax uses the element-wise y * (1 - y), like softmaxPrime
+    template <typename T>
+    void activationPrimeProduct(Activation activation, const T *y, const T *dOutput, T *delta, size_t n, double negativeSlope = 0.2);
 }
 
 #endif
\ No newline at end of file
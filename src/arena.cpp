@@ -0,0 +1,118 @@
+#include "arena.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace litenet {
+    template <typename T>
+    void BasicParameterArena<T>::layOut(const std::vector<std::unique_ptr<layers::BasicLayer<T>>> &layers, int stateCount) {
+        const size_t alignment = memory::alignment / sizeof(T);
+        std::vector<Segment> laidOut;
+        size_t offset = 0;
+        size_t dense = 0;
+        for (bool sparse : {false, true}) {
+            for (const auto &layer : layers) {
+                // Map order is unspecified: sort the names so the layout only depends on the model
+                std::vector<std::string> names;
+                for (const auto &entry : layer->parameters) {
+                    if ((layer->sparseGradients.count(entry.first) > 0) == sparse) {
+                        names.push_back(entry.first);
+                    }
+                }
+                std::sort(names.begin(), names.end());
+                for (const std::string &name : names) {
+                    BasicMatrix<T> &parameter = layer->parameters[name];
+                    if (!sparse) {
+                        auto gradient = layer->gradients.find(name);
+                        if (gradient == layer->gradients.end() || gradient->second.getSize() != parameter.getSize()) {
+                            throw std::runtime_error("No gradient matching parameter " + name + " of layer " + layer->getName());
+                        }
+                    }
+                    laidOut.push_back({layer.get(), name, &parameter, offset, parameter.getSize(), sparse});
+                    offset += (parameter.getSize() + alignment - 1) / alignment * alignment;
+                }
+            }
+            if (!sparse) {
+                dense = offset;
+            }
+        }
+
+        memory::Buffer<T> allocation(offset + dense + stateCount * offset);
+        for (const Segment &segment : laidOut) {
+            segment.parameter->bind(allocation.data() + segment.offset);
+            if (!segment.sparse) {
+                segment.layer->gradients[segment.name].bind(allocation.data() + offset + segment.offset);
+            }
+        }
+        storage = std::move(allocation);
+        segments = std::move(laidOut);
+        size = offset;
+        denseSize = dense;
+        this->stateCount = stateCount;
+        steps = 0;
+    }
+
+    template <typename T>
+    void BasicParameterArena<T>::bindReplica(const std::vector<std::unique_ptr<layers::BasicLayer<T>>> &layers, const std::vector<std::unique_ptr<layers::BasicLayer<T>>> &replica, T *gradients) {
+        if (replica.size() != layers.size()) {
+            throw std::invalid_argument("A replica must have one layer per layer of the model");
+        }
+        for (const Segment &segment : segments) {
+            size_t index = std::find_if(layers.begin(), layers.end(), [&](const auto &layer) { return layer.get() == segment.layer; }) - layers.begin();
+            if (index == layers.size()) {
+                throw std::invalid_argument("Layers do not match the arena");
+            }
+            layers::BasicLayer<T> &copy = *replica[index];
+            copy.parameters[segment.name].bind(storage.data() + segment.offset);
+            if (!segment.sparse) {
+                copy.gradients[segment.name].bind(gradients + segment.offset);
+            }
+        }
+    }
+
+    template <typename T>
+    T *BasicParameterArena<T>::getParameters() {
+        return storage.data();
+    }
+
+    template <typename T>
+    T *BasicParameterArena<T>::getGradients() {
+        return storage.data() + size;
+    }
+
+    template <typename T>
+    T *BasicParameterArena<T>::getState(int i) {
+        if (i < 0 || i >= stateCount) {
+            throw std::invalid_argument("Invalid optimizer state index");
+        }
+        return storage.data() + size + denseSize + static_cast<size_t>(i) * size;
+    }
+
+    template <typename T>
+    size_t BasicParameterArena<T>::getSize() const {
+        return size;
+    }
+
+    template <typename T>
+    size_t BasicParameterArena<T>::getDenseSize() const {
+        return denseSize;
+    }
+
+    template <typename T>
+    int BasicParameterArena<T>::getStateCount() const {
+        return stateCount;
+    }
+
+    template <typename T>
+    const std::vector<typename BasicParameterArena<T>::Segment> &BasicParameterArena<T>::getSegments() const {
+        return segments;
+    }
+
+    template <typename T>
+    long long BasicParameterArena<T>::nextStep() {
+        return ++steps;
+    }
+
+    template class BasicParameterArena<double>;
+    template class BasicParameterArena<float>;
+}
\ No newline at end of file
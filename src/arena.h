@@ -0,0 +1,64 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include "matrix.h"
+#include "layers.h"
+#include "memory.h"
+
+#include <vector>
+#include <memory>
+#include <string>
+
+namespace litenet {
+    // One contiguous, 64-byte aligned allocation holding every parameter of a model, their dense gradients and
+    // the optimizer's per-element state, laid out so that one index addresses the same element in each array:
+    // parameter element k is getParameters()[k], its gradient getGradients()[k] and its state getState(i)[k].
+    // Parameters with a dense gradient come first, in the first getDenseSize() elements; those with a
+    // row-sparse gradient (see layers::SparseRows) follow and have no dense gradient. Each tensor starts on a
+    // 64-byte boundary and the padding between tensors stays zero, so sweeping it is harmless. The layers'
+    // parameter and gradient matrices are bound to the arena and keep working as before, while saving the
+    // parameters or summing the gradients of several replicas is a pass over one flat array
+    template <typename T>
+    class BasicParameterArena {
+        public:
+            struct Segment {
+                layers::BasicLayer<T> *layer;
+                std::string name;
+                BasicMatrix<T> *parameter;
+                size_t offset; // in elements
+                size_t size; // elements of the parameter; the segment extends to the next offset
+                bool sparse;
+            };
+            // Binds the parameters and dense gradients of the built layers, keeping their values, and zeroes
+            // stateCount arrays of optimizer state and the step count. Laying out again moves everything to a
+            // new allocation
+            void layOut(const std::vector<std::unique_ptr<layers::BasicLayer<T>>> &layers, int stateCount);
+            // Binds the parameters of replica, copies of the laid-out layers (see layers::BasicLayer::replicate),
+            // to the arena, so that they share them, and their dense gradients to gradients, which must hold
+            // getDenseSize() elements and is laid out like getGradients()
+            void bindReplica(const std::vector<std::unique_ptr<layers::BasicLayer<T>>> &layers, const std::vector<std::unique_ptr<layers::BasicLayer<T>>> &replica, T *gradients);
+            T *getParameters();
+            T *getGradients();
+            T *getState(int i);
+            size_t getSize() const;
+            size_t getDenseSize() const;
+            int getStateCount() const;
+            const std::vector<Segment> &getSegments() const;
+            // Counts the optimizer steps taken over the arena and returns the new count
+            long long nextStep();
+        private:
+            memory::Buffer<T> storage; // parameters, then dense gradients, then the state arrays
+            std::vector<Segment> segments; // by offset
+            size_t size = 0;
+            size_t denseSize = 0;
+            int stateCount = 0;
+            long long steps = 0;
+    };
+
+    using ParameterArena = BasicParameterArena<double>;
+
+    extern template class BasicParameterArena<double>;
+    extern template class BasicParameterArena<float>;
+}
+
+#endif
\ No newline at end of file
@@ -70,13 +70,13 @@ int main() {
     litenet::Matrix _inputs = mnistImagesToMatrix("data/train-images.idx3-ubyte");
     litenet::Matrix _targets = mnistLabelsToMatrix("data/train-labels.idx1-ubyte");
 
-    // Training set (50000 samples)
-    litenet::Matrix trainingInputs = _inputs.subsetRows(0, 49999);
-    litenet::Matrix trainingTargets = _targets.subsetRows(0, 49999);
+    // Training set (50000 samples), a view into the loaded data rather than a copy
+    litenet::MatrixView trainingInputs = _inputs.viewRows(0, 49999);
+    litenet::MatrixView trainingTargets = _targets.viewRows(0, 49999);
 
     // Validation set (1000 samples)
-    litenet::Matrix validationInputs = _inputs.subsetRows(50000, 59999);
-    litenet::Matrix validationTargets = _targets.subsetRows(50000, 59999);
+    litenet::MatrixView validationInputs = _inputs.viewRows(50000, 59999);
+    litenet::MatrixView validationTargets = _targets.viewRows(50000, 59999);
 
     // Testing set (10000 samples)
     litenet::Matrix testingInputs = mnistImagesToMatrix("data/t10k-images.idx3-ubyte");
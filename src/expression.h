@@ -0,0 +1,411 @@
+#ifndef EXPRESSION_H
+#define EXPRESSION_H
+
+#include "simd.h"
+#include "threads.h"
+
+#include <cmath>
+#include <cstddef>
+#include <string>
+#include <stdexcept>
+#include <type_traits>
+#include <memory>
+#include <utility>
+#include <vector>
+
+// Lazy element-wise matrix arithmetic
+//
+// Element-wise operators on matrices return lightweight expression objects instead of new matrices.
+// Nothing is computed until an expression is assigned to a Matrix (or reduced with sum/max/min),
+// at which point the whole tree is evaluated in a single fused loop without temporaries, e.g.
+//     m = beta1 * m + (1 - beta1) * gradient;   // one pass, no allocation
+// Expressions keep references to the matrix variables they read, so an expression stored with auto must
+// not outlive them; temporary matrices (rvalues) are moved into the expression instead. Methods of Matrix
+// that are not element-wise, such as transpose, evaluate the expression into a Matrix first. The two
+// branches of ?: must have one type: sums and differences share one, as do scalar +, -, * and negation;
+// convert one branch to Matrix to mix other kinds.
+namespace litenet {
+    template <typename T>
+    class BasicMatrix;
+    template <typename T>
+    class BasicMatrixView;
+
+    template <typename E>
+    class MatrixExpression;
+
+    namespace expression {
+        template <typename T>
+        class Temporary;
+        template <typename E, typename Op>
+        class Unary;
+        template <typename L, typename R, typename Op>
+        class Binary;
+
+        // Scalar type an expression evaluates to, usable while the expression type is still incomplete
+        template <typename E>
+        struct ScalarOf;
+        template <typename T>
+        struct ScalarOf<BasicMatrix<T>> {
+            using Type = T;
+        };
+        template <typename T>
+        struct ScalarOf<BasicMatrixView<T>> {
+            using Type = T;
+        };
+        template <typename T>
+        struct ScalarOf<Temporary<T>> {
+            using Type = T;
+        };
+        template <typename E, typename Op>
+        struct ScalarOf<Unary<E, Op>> {
+            using Type = typename ScalarOf<E>::Type;
+        };
+        template <typename L, typename R, typename Op>
+        struct ScalarOf<Binary<L, R, Op>> {
+            using Type = typename ScalarOf<L>::Type;
+        };
+        template <typename E>
+        using Scalar = typename ScalarOf<E>::Type;
+
+        // Matrices are captured by reference, views and intermediate nodes by value
+        template <typename E>
+        struct Operand {
+            using Type = const E;
+        };
+        template <typename T>
+        struct Operand<BasicMatrix<T>> {
+            using Type = const BasicMatrix<T> &;
+        };
+
+        // a + sign * b: a sum (sign 1) and a difference (sign -1) share one type. Multiplying by +-1 is exact,
+        // so the result is that of a + b or a - b, with or without a fused multiply-add
+        template <typename T>
+        struct Add {
+            T sign;
+            const char *name() const { return sign > 0 ? "addition" : "subtraction"; }
+            T operator()(T a, T b) const { return a + sign * b; }
+        };
+        struct Multiply {
+            const char *name() const { return "Hadamard product"; }
+            template <typename T>
+            T operator()(T a, T b) const { return a * b; }
+        };
+        struct Divide {
+            const char *name() const { return "division"; }
+            template <typename T>
+            T operator()(T a, T b) const { return a / b; }
+        };
+
+        // Scalar operands are stored in the expression's scalar type so float expressions stay in float
+        // x * scale + shift covers scalar +, - and * and negation, which thus share one type. Each has a scale
+        // of +-1 or a shift of -0, so its result is exact as with a single operation
+        template <typename T>
+        struct Affine {
+            T scale;
+            T shift;
+            T operator()(T x) const { return x * scale + shift; }
+        };
+        template <typename T>
+        struct DivideScalar {
+            T scalar;
+            T operator()(T x) const { return x / scalar; }
+        };
+        template <typename T>
+        struct Pow {
+            T exponent;
+            T operator()(T x) const { return exponent == 2 ? x * x : std::pow(x, exponent); }
+        };
+        struct Sqrt {
+            template <typename T>
+            T operator()(T x) const { return std::sqrt(x); }
+        };
+        struct Abs {
+            template <typename T>
+            T operator()(T x) const { return std::abs(x); }
+        };
+        struct Sign {
+            template <typename T>
+            T operator()(T x) const { return x > 0 ? 1 : x < 0 ? -1 : 0; }
+        };
+        template <typename T>
+        struct Log {
+            T logBase;
+            T operator()(T x) const { return std::log(x) / logBase; }
+        };
+
+        // A matrix passed to an operator as an rvalue, moved into storage the expression owns (copies of the
+        // expression share it), so an expression kept with auto does not refer to a destroyed temporary
+        template <typename T>
+        class Temporary : public MatrixExpression<Temporary<T>> {
+            public:
+                Temporary(BasicMatrix<T> &&m) : matrix(std::make_shared<const BasicMatrix<T>>(std::move(m))), data(matrix->getData()), rows(matrix->getRows()), cols(matrix->getCols()) {}
+                Temporary(const BasicMatrix<T> &m) : matrix(std::make_shared<const BasicMatrix<T>>(m)), data(matrix->getData()), rows(matrix->getRows()), cols(matrix->getCols()) {}
+                int getRows() const { return rows; }
+                int getCols() const { return cols; }
+                const T *getData() const { return data; }
+                T element(size_t i) const { return data[i]; }
+                void validate() const {}
+            private:
+                std::shared_ptr<const BasicMatrix<T>> matrix;
+                const T *data;
+                int rows;
+                int cols;
+        };
+
+        // Operators take their operands by forwarding reference; A is the deduced type of one
+        template <typename E>
+        std::true_type isExpressionPointer(const MatrixExpression<E> *);
+        std::false_type isExpressionPointer(const void *);
+        template <typename A>
+        constexpr bool isExpression = decltype(isExpressionPointer(static_cast<const std::decay_t<A> *>(nullptr)))::value;
+        template <typename... A>
+        using IfExpressions = std::enable_if_t<(isExpression<A> && ...)>;
+        // The expression type of A, also when A is a reference to the MatrixExpression base
+        template <typename D>
+        struct DerivedOf {
+            using Type = D;
+        };
+        template <typename E>
+        struct DerivedOf<MatrixExpression<E>> {
+            using Type = E;
+        };
+        template <typename A>
+        using Derived = typename DerivedOf<std::decay_t<A>>::Type;
+        template <typename A>
+        using ArgumentScalar = Scalar<Derived<A>>;
+        template <typename A>
+        constexpr bool isTemporary = !std::is_lvalue_reference_v<A> && std::is_same_v<std::decay_t<A>, BasicMatrix<ArgumentScalar<A>>>;
+        // The operand a node stores for A: a Temporary for a matrix rvalue, otherwise the expression itself
+        // (which Operand keeps by reference for a matrix)
+        template <typename A>
+        using Captured = std::conditional_t<isTemporary<A>, Temporary<ArgumentScalar<A>>, Derived<A>>;
+        template <typename A>
+        decltype(auto) capture(A &&a) {
+            if constexpr (isTemporary<A>) {
+                return Temporary<ArgumentScalar<A>>(std::forward<A>(a));
+            } else {
+                return static_cast<const Derived<A> &>(a);
+            }
+        }
+
+        template <typename E, typename Op>
+        class Unary : public MatrixExpression<Unary<E, Op>> {
+            public:
+                Unary(const E &e, Op op) : e(e), op(op) {}
+                int getRows() const { return e.getRows(); }
+                int getCols() const { return e.getCols(); }
+                Scalar<E> element(size_t i) const { return op(e.element(i)); }
+                void validate() const { e.validate(); }
+            private:
+                typename Operand<E>::Type e;
+                Op op;
+        };
+
+        template <typename L, typename R, typename Op>
+        class Binary : public MatrixExpression<Binary<L, R, Op>> {
+            static_assert(std::is_same_v<Scalar<L>, Scalar<R>>, "Operands of an element-wise operation must have the same scalar type");
+            public:
+                Binary(const L &l, const R &r, Op op = Op()) : l(l), r(r), op(op) {
+                    if (l.getRows() != r.getRows() || l.getCols() != r.getCols()) {
+                        throw std::invalid_argument(std::string("Matrix dimensions are not compatible for ") + op.name());
+                    }
+                }
+                int getRows() const { return l.getRows(); }
+                int getCols() const { return l.getCols(); }
+                Scalar<L> element(size_t i) const { return op(l.element(i), r.element(i)); }
+                void validate() const {
+                    l.validate();
+                    r.validate();
+                    if constexpr (std::is_same_v<Op, Divide>) { // keep the eager operator's division by zero check
+                        size_t n = static_cast<size_t>(r.getRows()) * r.getCols();
+                        for (size_t i = 0; i < n; i++) {
+                            if (r.element(i) == 0) {
+                                throw std::invalid_argument("Division by zero");
+                            }
+                        }
+                    }
+                }
+            private:
+                typename Operand<L>::Type l;
+                typename Operand<R>::Type r;
+                Op op;
+        };
+
+        // Fused evaluation loops over [begin, end), compiled for several instruction sets and picked at load time
+        template <typename T, typename E>
+        LITENET_TARGET_CLONES
+        void assign(T *out, const E &e, size_t begin, size_t end) {
+            const E local = e; // scalars held by value cannot alias out, so they stay in registers
+            for (size_t i = begin; i < end; i++) {
+                out[i] = local.element(i);
+            }
+        }
+
+        template <typename E>
+        LITENET_TARGET_CLONES
+        Scalar<E> sum(const E &e, size_t begin, size_t end) {
+            Scalar<E> s = 0;
+            for (size_t i = begin; i < end; i++) {
+                s += e.element(i);
+            }
+            return s;
+        }
+
+        // Evaluates e into out (n elements), split across the thread pool when large
+        template <typename T, typename E>
+        void evaluate(T *out, const E &e, size_t n) {
+            threads::parallelFor(n, threads::grain, [&](size_t begin, size_t end) {
+                assign(out, e, begin, end);
+            });
+        }
+
+        // Reduces [0, n) by combining reduceRange(begin, end) over fixed chunks, in parallel when large
+        template <typename T, typename Range, typename Combine>
+        T reduce(size_t n, const Range &reduceRange, const Combine &combine) {
+            size_t chunk = threads::reductionChunk(n);
+            if (n <= chunk) {
+                return reduceRange(size_t(0), n);
+            }
+            T partial[threads::maxChunks];
+            threads::parallelFor(n, chunk, [&](size_t begin, size_t end) {
+                partial[begin / chunk] = reduceRange(begin, end);
+            });
+            T result = partial[0];
+            for (size_t i = 1; i < (n + chunk - 1) / chunk; i++) {
+                result = combine(result, partial[i]);
+            }
+            return result;
+        }
+    }
+
+    // Base of Matrix, MatrixView and of every expression node (CRTP); E provides getRows, getCols, element(i) and validate()
+    template <typename E>
+    class MatrixExpression {
+        using T = expression::Scalar<E>;
+        static constexpr bool isMatrix = std::is_same_v<E, BasicMatrix<T>>;
+        static constexpr bool isView = std::is_same_v<E, BasicMatrixView<T>>;
+        static constexpr bool isOwned = std::is_same_v<E, expression::Temporary<T>>;
+        // Matrices and contiguous views are reduced with the SIMD kernels, everything else element by element
+        const T *contiguousData() const {
+            if constexpr (isMatrix || isOwned) {
+                return self().getData();
+            } else if constexpr (isView) {
+                return self().isContiguous() ? self().getData() : nullptr;
+            } else {
+                return nullptr;
+            }
+        }
+        BasicMatrix<T> evaluated() const { return BasicMatrix<T>(self()); }
+        // The operand of a lazy method: this expression, or the matrix itself when it is an rvalue
+        E &&moved() { return static_cast<E &&>(static_cast<E &>(*this)); }
+        public:
+            const E &self() const { return static_cast<const E &>(*this); }
+            size_t size() const { return static_cast<size_t>(self().getRows()) * self().getCols(); }
+
+            template <typename R, typename = expression::IfExpressions<R>>
+            expression::Binary<E, expression::Captured<R>, expression::Multiply> hadamard(R &&m) const & { return {self(), expression::capture(std::forward<R>(m))}; }
+            template <typename R, typename = expression::IfExpressions<R>>
+            expression::Binary<expression::Captured<E>, expression::Captured<R>, expression::Multiply> hadamard(R &&m) && { return {expression::capture(moved()), expression::capture(std::forward<R>(m))}; }
+            expression::Unary<E, expression::Pow<T>> pow(double exponent) const & { return {self(), {static_cast<T>(exponent)}}; }
+            expression::Unary<expression::Captured<E>, expression::Pow<T>> pow(double exponent) && { return {expression::capture(moved()), {static_cast<T>(exponent)}}; }
+            expression::Unary<E, expression::Sqrt> sqrt() const & { return {self(), {}}; }
+            expression::Unary<expression::Captured<E>, expression::Sqrt> sqrt() && { return {expression::capture(moved()), {}}; }
+            expression::Unary<E, expression::Abs> abs() const & { return {self(), {}}; }
+            expression::Unary<expression::Captured<E>, expression::Abs> abs() && { return {expression::capture(moved()), {}}; }
+            expression::Unary<E, expression::Sign> sign() const & { return {self(), {}}; }
+            expression::Unary<expression::Captured<E>, expression::Sign> sign() && { return {expression::capture(moved()), {}}; }
+            expression::Unary<E, expression::Log<T>> log(double base = 2) const & { return {self(), {static_cast<T>(std::log(base))}}; }
+            expression::Unary<expression::Captured<E>, expression::Log<T>> log(double base = 2) && { return {expression::capture(moved()), {static_cast<T>(std::log(base))}}; }
+
+            // Element (i, j) of the expression, computed alone
+            T operator()(int i, int j) const {
+                self().validate();
+                return self().element(static_cast<size_t>(i) * self().getCols() + j);
+            }
+            std::vector<int> getShape() const { return {self().getRows(), self().getCols()}; }
+            // The rest of the Matrix interface, on the evaluated expression; Matrix has its own versions
+            BasicMatrix<T> transpose() const { return evaluated().transpose(); }
+            BasicMatrix<T> normalize() const { return evaluated().normalize(); }
+            BasicMatrix<T> sum(int axis) const { return evaluated().sum(axis); }
+            BasicMatrix<T> max(int axis) const { return evaluated().max(axis); }
+            BasicMatrix<T> min(int axis) const { return evaluated().min(axis); }
+            std::vector<T> flatten() const { return evaluated().flatten(); }
+            BasicMatrix<T> subsetCols(int start, int end) const { return evaluated().subsetCols(start, end); }
+            BasicMatrix<T> subsetRows(int start, int end) const { return evaluated().subsetRows(start, end); }
+            void print() const { evaluated().print(); }
+
+            T sum() const {
+                self().validate();
+                const T *data = contiguousData();
+                return expression::reduce<T>(size(), [&](size_t begin, size_t end) {
+                    return data ? simd::kernels<T>().sum(data + begin, end - begin) : expression::sum(self(), begin, end);
+                }, [](T a, T b) { return a + b; });
+            }
+            T max() const {
+                self().validate();
+                const T *data = contiguousData();
+                return expression::reduce<T>(size(), [&](size_t begin, size_t end) {
+                    if (data) {
+                        return simd::kernels<T>().max(data + begin, end - begin);
+                    }
+                    T m = self().element(begin);
+                    for (size_t i = begin + 1; i < end; i++) {
+                        if (self().element(i) > m) {
+                            m = self().element(i);
+                        }
+                    }
+                    return m;
+                }, [](T a, T b) { return a > b ? a : b; });
+            }
+            T min() const {
+                self().validate();
+                const T *data = contiguousData();
+                return expression::reduce<T>(size(), [&](size_t begin, size_t end) {
+                    if (data) {
+                        return simd::kernels<T>().min(data + begin, end - begin);
+                    }
+                    T m = self().element(begin);
+                    for (size_t i = begin + 1; i < end; i++) {
+                        if (self().element(i) < m) {
+                            m = self().element(i);
+                        }
+                    }
+                    return m;
+                }, [](T a, T b) { return a < b ? a : b; });
+            }
+    };
+
+    // Scalars are given as double and converted once to the expression's scalar type
+    template <typename L, typename R, typename = expression::IfExpressions<L, R>>
+    expression::Binary<expression::Captured<L>, expression::Captured<R>, expression::Add<expression::ArgumentScalar<L>>> operator+(L &&l, R &&r) { return {expression::capture(std::forward<L>(l)), expression::capture(std::forward<R>(r)), {1}}; }
+    template <typename E, typename = expression::IfExpressions<E>>
+    expression::Unary<expression::Captured<E>, expression::Affine<expression::ArgumentScalar<E>>> operator+(E &&e, double scalar) { return {expression::capture(std::forward<E>(e)), {1, static_cast<expression::ArgumentScalar<E>>(scalar)}}; }
+    template <typename E, typename = expression::IfExpressions<E>>
+    expression::Unary<expression::Captured<E>, expression::Affine<expression::ArgumentScalar<E>>> operator+(double scalar, E &&e) { return {expression::capture(std::forward<E>(e)), {1, static_cast<expression::ArgumentScalar<E>>(scalar)}}; }
+
+    template <typename L, typename R, typename = expression::IfExpressions<L, R>>
+    expression::Binary<expression::Captured<L>, expression::Captured<R>, expression::Add<expression::ArgumentScalar<L>>> operator-(L &&l, R &&r) { return {expression::capture(std::forward<L>(l)), expression::capture(std::forward<R>(r)), {-1}}; }
+    template <typename E, typename = expression::IfExpressions<E>>
+    expression::Unary<expression::Captured<E>, expression::Affine<expression::ArgumentScalar<E>>> operator-(E &&e, double scalar) { return {expression::capture(std::forward<E>(e)), {1, -static_cast<expression::ArgumentScalar<E>>(scalar)}}; }
+    template <typename E, typename = expression::IfExpressions<E>>
+    expression::Unary<expression::Captured<E>, expression::Affine<expression::ArgumentScalar<E>>> operator-(double scalar, E &&e) { return {expression::capture(std::forward<E>(e)), {-1, static_cast<expression::ArgumentScalar<E>>(scalar)}}; }
+    template <typename E, typename = expression::IfExpressions<E>>
+    expression::Unary<expression::Captured<E>, expression::Affine<expression::ArgumentScalar<E>>> operator-(E &&e) { return {expression::capture(std::forward<E>(e)), {-1, -0.0f}}; }
+
+    template <typename E, typename = expression::IfExpressions<E>>
+    expression::Unary<expression::Captured<E>, expression::Affine<expression::ArgumentScalar<E>>> operator*(E &&e, double factor) { return {expression::capture(std::forward<E>(e)), {static_cast<expression::ArgumentScalar<E>>(factor), -0.0f}}; }
+    template <typename E, typename = expression::IfExpressions<E>>
+    expression::Unary<expression::Captured<E>, expression::Affine<expression::ArgumentScalar<E>>> operator*(double factor, E &&e) { return {expression::capture(std::forward<E>(e)), {static_cast<expression::ArgumentScalar<E>>(factor), -0.0f}}; }
+
+    template <typename L, typename R, typename = expression::IfExpressions<L, R>>
+    expression::Binary<expression::Captured<L>, expression::Captured<R>, expression::Divide> operator/(L &&l, R &&r) { return {expression::capture(std::forward<L>(l)), expression::capture(std::forward<R>(r))}; }
+    template <typename E, typename = expression::IfExpressions<E>>
+    expression::Unary<expression::Captured<E>, expression::DivideScalar<expression::ArgumentScalar<E>>> operator/(E &&e, double factor) {
+        if (factor == 0) {
+            throw std::invalid_argument("Division by zero");
+        }
+        return {expression::capture(std::forward<E>(e)), {static_cast<expression::ArgumentScalar<E>>(factor)}};
+    }
+}
+
+#endif
\ No newline at end of file
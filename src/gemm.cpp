@@ -0,0 +1,177 @@
+#include "gemm.h"
+#include "memory.h"
+#include "threads.h"
+
+#include <vector>
+#include <algorithm>
+
+namespace litenet::gemm {
+    namespace {
+        // Register tile: the micro-kernel keeps an MR x NR block of C in registers
+        // float uses the same tile: widening it to 4 x 16 floats spills the accumulators
+        constexpr int MR = 4;
+        constexpr int NR = 8;
+
+        // Cache blocking: a KC x NR sliver of B stays in L1 while it is streamed against
+        // an MC x KC block of A that stays in L2; a KC x NC panel of B is shared by all blocks of A
+        constexpr int MC = 128; // multiple of MR
+        constexpr int KC = 256;
+        constexpr int NC = 2048; // multiple of NR
+
+        // Smallest tile of C worth handing to another thread, in multiply-adds
+        constexpr size_t minTileWork = 1 << 16;
+
+        // Packs the mc x kc block of op(A) starting at (i0, p0) into MR-row slivers stored column by column,
+        // zero-padding the last sliver so the micro-kernel never needs bounds checks
+        template <typename T>
+        void packA(bool transA, int i0, int p0, int mc, int kc, const T *a, int lda, T *packed) {
+            for (int i = 0; i < mc; i += MR) {
+                int rows = std::min(MR, mc - i);
+                for (int p = 0; p < kc; p++) {
+                    for (int r = 0; r < rows; r++) {
+                        int row = i0 + i + r;
+                        int col = p0 + p;
+                        packed[r] = transA ? a[col * lda + row] : a[row * lda + col];
+                    }
+                    for (int r = rows; r < MR; r++) {
+                        packed[r] = 0;
+                    }
+                    packed += MR;
+                }
+            }
+        }
+
+        // Packs the kc x nc panel of op(B) starting at (p0, j0) into NR-column slivers stored row by row
+        template <typename T>
+        void packB(bool transB, int p0, int j0, int kc, int nc, const T *b, int ldb, T *packed) {
+            for (int j = 0; j < nc; j += NR) {
+                int cols = std::min(NR, nc - j);
+                for (int p = 0; p < kc; p++) {
+                    if (transB) {
+                        const T *column = b + (j0 + j) * ldb + p0 + p;
+                        for (int c = 0; c < cols; c++) {
+                            packed[c] = column[c * ldb];
+                        }
+                    } else {
+                        const T *row = b + (p0 + p) * ldb + j0 + j;
+                        for (int c = 0; c < cols; c++) {
+                            packed[c] = row[c];
+                        }
+                    }
+                    for (int c = cols; c < NR; c++) {
+                        packed[c] = 0;
+                    }
+                    packed += NR;
+                }
+            }
+        }
+
+        // C tile (rows x cols, at most MR x NR) = alpha * (packed A sliver * packed B sliver) + beta * C
+        // beta == 0 overwrites C without reading it
+        template <typename T>
+        void microKernel(int kc, const T *a, const T *b, T *c, int ldc, int rows, int cols, T alpha, T beta) {
+            T acc[MR][NR] = {};
+            for (int p = 0; p < kc; p++) {
+                for (int i = 0; i < MR; i++) {
+                    for (int j = 0; j < NR; j++) {
+                        acc[i][j] += a[i] * b[j];
+                    }
+                }
+                a += MR;
+                b += NR;
+            }
+            for (int i = 0; i < rows; i++) {
+                T *row = c + i * ldc;
+                if (beta == 0) {
+                    for (int j = 0; j < cols; j++) {
+                        row[j] = alpha * acc[i][j];
+                    }
+                } else if (beta == 1) {
+                    for (int j = 0; j < cols; j++) {
+                        row[j] += alpha * acc[i][j];
+                    }
+                } else {
+                    for (int j = 0; j < cols; j++) {
+                        row[j] = alpha * acc[i][j] + beta * row[j];
+                    }
+                }
+            }
+        }
+
+        template <typename T>
+        void scale(int m, int n, T beta, T *c, int ldc) {
+            for (int i = 0; i < m; i++) {
+                T *row = c + i * ldc;
+                for (int j = 0; j < n; j++) {
+                    row[j] = beta == 0 ? 0 : beta * row[j];
+                }
+            }
+        }
+    }
+
+    template <typename T>
+    void multiply(bool transA, bool transB, int m, int n, int k, T alpha, const T *a, int lda, const T *b, int ldb, T beta, T *c, int ldc, const Epilogue<T> *epilogue) {
+        if (m == 0 || n == 0) {
+            return;
+        }
+        if (k == 0 || alpha == 0) {
+            scale(m, n, beta, c, ldc);
+            if (epilogue) {
+                epilogue->function(epilogue->context, 0, 0, m, n, c, ldc);
+            }
+            return;
+        }
+
+        // Packing buffers are reused across calls so steady-state training does not allocate
+        thread_local std::vector<T, memory::PoolAllocator<T>> packedA;
+        thread_local std::vector<T, memory::PoolAllocator<T>> packedB;
+        packedB.resize(KC * NC);
+
+        for (int jc = 0; jc < n; jc += NC) {
+            int nc = std::min(NC, n - jc);
+            for (int pc = 0; pc < k; pc += KC) {
+                int kc = std::min(KC, k - pc);
+                T blockBeta = pc == 0 ? beta : 1; // later k blocks accumulate into C
+                bool lastBlock = pc + kc == k;
+                packB(transB, pc, jc, kc, nc, b, ldb, packedB.data());
+                const T *panelB = packedB.data(); // shared by every thread working on this panel
+
+                // The m x nc block of C is split into tiles of MC rows and a multiple of NR columns, about
+                // two per thread for stealing to balance, but none smaller than minTileWork; each tile
+                // packs its own slice of A on the thread that runs it
+                int tilesM = (m + MC - 1) / MC;
+                size_t work = static_cast<size_t>(m) * nc * kc;
+                size_t numThreads = threads::getNumThreads();
+                size_t wanted = std::min<size_t>(numThreads > 1 ? 2 * numThreads : 1, std::max<size_t>(1, work / minTileWork));
+                int slivers = (nc + NR - 1) / NR;
+                int tilesN = std::clamp<int>((wanted + tilesM - 1) / tilesM, 1, slivers);
+                int tileCols = (slivers + tilesN - 1) / tilesN * NR;
+                tilesN = (nc + tileCols - 1) / tileCols;
+
+                threads::parallelFor(static_cast<size_t>(tilesM) * tilesN, 1, [&](size_t begin, size_t end) {
+                    packedA.resize(MC * KC);
+                    for (size_t tile = begin; tile < end; tile++) {
+                        int ic = static_cast<int>(tile / tilesN) * MC;
+                        int j0 = static_cast<int>(tile % tilesN) * tileCols;
+                        int mc = std::min(MC, m - ic);
+                        int j1 = std::min(nc, j0 + tileCols);
+                        packA(transA, ic, pc, mc, kc, a, lda, packedA.data());
+                        for (int jr = j0; jr < j1; jr += NR) {
+                            for (int ir = 0; ir < mc; ir += MR) {
+                                microKernel(kc, packedA.data() + ir * kc, panelB + jr * kc,
+                                            c + (ic + ir) * ldc + jc + jr, ldc,
+                                            std::min(MR, mc - ir), std::min(NR, nc - jr), alpha, blockBeta);
+                            }
+                        }
+                        if (lastBlock && epilogue) { // the tile of C is complete and still in cache
+                            epilogue->function(epilogue->context, ic, jc + j0, mc, j1 - j0, c + ic * ldc + jc + j0, ldc);
+                        }
+                    }
+                });
+            }
+        }
+    }
+
+    template void multiply<double>(bool, bool, int, int, int, double, const double *, int, const double *, int, double, double *, int, const Epilogue<double> *);
+    template void multiply<float>(bool, bool, int, int, int, float, const float *, int, const float *, int, float, float *, int, const Epilogue<float> *);
+}
\ No newline at end of file
@@ -0,0 +1,24 @@
+#ifndef GEMM_H
+#define GEMM_H
+
+namespace litenet::gemm {
+    // C = alpha * op(A) * op(B) + beta * C for row-major storage, where op(X) is X or its transpose
+    // op(A) is m x k, op(B) is k x n and C is m x n
+    // lda, ldb and ldc are the distances (in elements) between consecutive rows of the stored matrices
+    // When beta is 0, C is not read and may be uninitialized
+    // Instantiated for float and double
+    //
+    // An epilogue, when given, is called once on each finished block of C while it is still in cache:
+    // rows [i0, i0 + rows) and columns [j0, j0 + cols), starting at block with row distance ldc.
+    // The blocks do not overlap, together cover C, and may be processed concurrently.
+    template <typename T>
+    struct Epilogue {
+        void (*function)(const void *context, int i0, int j0, int rows, int cols, T *block, int ldc);
+        const void *context;
+    };
+
+    template <typename T>
+    void multiply(bool transA, bool transB, int m, int n, int k, T alpha, const T *a, int lda, const T *b, int ldb, T beta, T *c, int ldc, const Epilogue<T> *epilogue = nullptr);
+}
+
+#endif
\ No newline at end of file
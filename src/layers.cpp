@@ -2,137 +2,1549 @@
 #include "activations.h"
 #include "loss.h"
 #include "initializers.h"
+#include "threads.h"
+#include "random.h"
 
 #include <stdexcept>
+#include <algorithm>
+#include <random>
+#include <cmath>
 
 namespace litenet::layers {
-    std::string Layer::getName() const {
+    namespace {
+        // GEMM epilogue of Dense and Conv2D: adds a bias per output column and applies an activation
+        template <typename T>
+        struct BiasActivation {
+            const T *bias;
+            activations::Activation activation;
+        };
+
+        template <typename T>
+        void biasActivationEpilogue(const void *context, int /*i0*/, int j0, int rows, int cols, T *block, int ldc) {
+            const BiasActivation<T> *epilogue = static_cast<const BiasActivation<T> *>(context);
+            activations::biasActivation(epilogue->activation, epilogue->bias + j0, block, ldc, rows, cols);
+        }
+
+        template <typename T>
+        T gateSigmoid(T x) {
+            return 1 / (1 + std::exp(-x));
+        }
+
+        // Sums per-row contributions into width accumulators over rows [0, rows). Rows are split into chunks
+        // whose boundaries depend only on rows and width, and the chunk partials are added in order, so the
+        // result does not depend on the number of threads
+        template <typename F>
+        void reduceRows(int rows, int width, std::vector<double, memory::PoolAllocator<double>> &partials, double *result, const F &accumulate) {
+            size_t rowsPerChunk = std::max<size_t>((rows + threads::maxChunks - 1) / threads::maxChunks, std::max<size_t>(1, threads::grain / std::max(1, width)));
+            size_t chunks = (rows + rowsPerChunk - 1) / rowsPerChunk;
+            partials.assign(chunks * width, 0);
+            threads::parallelFor(rows, rowsPerChunk, [&](size_t begin, size_t end) {
+                double *sums = partials.data() + begin / rowsPerChunk * width;
+                for (size_t r = begin; r < end; r++) {
+                    accumulate(static_cast<int>(r), sums);
+                }
+            });
+            std::fill(result, result + width, 0.0);
+            for (size_t c = 0; c < chunks; c++) {
+                for (int j = 0; j < width; j++) {
+                    result[j] += partials[c * width + j];
+                }
+            }
+        }
+    }
+
+    template <typename T>
+    std::string BasicLayer<T>::getName() const {
         return name;
     }
-    int Layer::getInFeatures() const {
+    template <typename T>
+    int BasicLayer<T>::getInFeatures() const {
         return inFeatures;
     }
-    int Layer::getOutFeatures() const {
+    template <typename T>
+    int BasicLayer<T>::getOutFeatures() const {
         return outFeatures;
     }
-    int Layer::getNumParameters() const {
+    template <typename T>
+    void BasicLayer<T>::setTraining(bool training) {
+        this->training = training;
+    }
+    template <typename T>
+    bool BasicLayer<T>::isTraining() const {
+        return training;
+    }
+    template <typename T>
+    int BasicLayer<T>::getNumParameters() const {
         return inFeatures * outFeatures + outFeatures; // change later
     }
-    Dense::Dense(int inFeatures, int outFeatures, const std::string &activation, std::unique_ptr<initializers::Initializer> kernel_initializer, std::unique_ptr<initializers::Initializer> bias_initializer) {
+    template <typename T>
+    std::unique_ptr<BasicLayer<T>> BasicLayer<T>::replicate(int) const {
+        throw std::runtime_error("Layer " + name + " cannot be replicated");
+    }
+    template <typename T>
+    BasicDense<T>::BasicDense(int inFeatures, int outFeatures, const std::string &activation, std::unique_ptr<initializers::Initializer> kernel_initializer, std::unique_ptr<initializers::Initializer> bias_initializer) {
         this->name = "Dense";
         this->inFeatures = inFeatures;
         this->outFeatures = outFeatures;
-        this->activation = activation;
+        this->activation = activations::fromName(activation);
         this->kernel_initializer = std::move(kernel_initializer);
         this->bias_initializer = std::move(bias_initializer);
     }
 
-    void Dense::build() {
+    template <typename T>
+    void BasicDense<T>::build() {
         // for now, inputs is a matrix of shape (samples, features)
         // weights is a matrix of shape (features, units)
         // biases is a matrix of shape (units,)
-        this->parameters["weights"] = kernel_initializer->initialize(inFeatures, outFeatures);
-        this->parameters["biases"] = bias_initializer->initialize(outFeatures, 1);
+        // initializers sample in double; the parameters are converted once to the layer's scalar type
+        this->parameters["weights"] = BasicMatrix<T>(kernel_initializer->initialize(this->inFeatures, this->outFeatures));
+        this->parameters["biases"] = BasicMatrix<T>(bias_initializer->initialize(this->outFeatures, 1));
+        this->gradients["weights"] = BasicMatrix<T>(this->inFeatures, this->outFeatures);
+        this->gradients["biases"] = BasicMatrix<T>(this->outFeatures, 1);
+        lookUpParameters();
+    }
+
+    template <typename T>
+    void BasicDense<T>::lookUpParameters() {
+        weights = &this->parameters["weights"];
+        biases = &this->parameters["biases"];
+        dWeights = &this->gradients["weights"];
+        dBiases = &this->gradients["biases"];
+    }
+
+    template <typename T>
+    std::unique_ptr<BasicLayer<T>> BasicDense<T>::replicate(int) const {
+        auto replica = std::make_unique<BasicDense<T>>(*this);
+        replica->lookUpParameters();
+        return replica;
     }
 
-    Matrix Dense::forward(const Matrix &inputs) {
+    template <typename T>
+    BasicMatrixView<T> BasicDense<T>::forward(BasicMatrixView<T> inputs) {
         // matrix multiplication:
         // inputs: (samples, features)
         // weights: (features, units)
         // inputs * weights: (samples, units)
         // biases: (units,)
         // 
-        // z = inputs * weights + biases
-        this->inputs = inputs;
-        Matrix z = inputs * this->parameters["weights"];
+        // outputs = activation(inputs * weights + biases), with the bias and activation applied by the GEMM
+        // to each block of outputs as soon as it is computed
+        this->inputs = this->training ? inputs : BasicMatrixView<T>(); // no copy: the caller keeps the inputs alive until backward
+        bool useFold = folded && !this->training;
+        const BasicMatrix<T> &w = useFold ? foldedWeights : *weights;
+        const BasicMatrix<T> &b = useFold ? foldedBiases : *biases;
+        activations::Activation a = useFold ? foldedActivation : activation;
+        if (a == activations::Activation::Softmax && logitsOutput && this->training) {
+            a = activations::Activation::Linear;
+        }
+        // Softmax needs whole rows, which a block may not span: it runs after the GEMM instead
+        BiasActivation<T> context{b.getData(), a == activations::Activation::Softmax ? activations::Activation::Linear : a};
+        litenet::gemm::Epilogue<T> fused{&biasActivationEpilogue<T>, &context};
+        BasicMatrix<T>::gemm(inputs, false, w, false, outputs, 1, 0, &fused);
+        if (a == activations::Activation::Softmax) {
+            activations::softmax(outputs, outputs);
+        }
+        return outputs;
+    }
 
-        for (int i = 0; i < z.getRows(); i++) {
-            for (int j = 0; j < z.getCols(); j++) {
-                z(i, j) += this->parameters["biases"](j, 0);
-            }
+    template <typename T>
+    void BasicDense<T>::setTraining(bool training) {
+        BasicLayer<T>::setTraining(training);
+        if (training) {
+            folded = false; // the weights are about to change
         }
+    }
 
-        return applyActivation(z);
+    template <typename T>
+    bool BasicDense<T>::canFold() const {
+        return activation == activations::Activation::Linear && weights != nullptr;
     }
 
-    Matrix Dense::backward(const Matrix &dOutput) {
-        // Compute pre-activation
-        Matrix z = inputs * this->parameters["weights"];
+    template <typename T>
+    void BasicDense<T>::fold(const BasicMatrix<T> &scale, const BasicMatrix<T> &shift, activations::Activation activation) {
+        if (!canFold()) {
+            throw std::runtime_error("Only a built Dense layer with a linear activation can be folded");
+        }
+        // activation((x * W + b) * scale + shift) = activation(x * (W * scale) + (b * scale + shift)),
+        // with scale and shift applied per unit (column)
+        BasicMatrix<T>::mulRowVector(*weights, scale, foldedWeights);
+        BasicMatrix<T>::mulColVector(*biases, scale, foldedBiases);
+        foldedBiases += shift;
+        foldedActivation = activation;
+        folded = true;
+    }
 
-        // Add biases
-        for (int i = 0; i < z.getRows(); i++) {
-            for (int j = 0; j < z.getCols(); j++) {
-                z(i, j) += this->parameters["biases"](j, 0);
-            }
+    template <typename T>
+    activations::Activation BasicDense<T>::getActivation() const {
+        return activation;
+    }
+
+    template <typename T>
+    void BasicDense<T>::setLogitsOutput(bool logits) {
+        logitsOutput = logits;
+    }
+
+    template <typename T>
+    const BasicMatrix<T> &BasicDense<T>::backward(const BasicMatrix<T> &dOutput) {
+        if (!this->training) {
+            throw std::runtime_error("Dense::backward called in inference mode");
+        }
+        if (dOutput.getRows() != outputs.getRows() || dOutput.getCols() != outputs.getCols()) {
+            throw std::invalid_argument("Output gradient dimensions do not match the layer outputs");
         }
 
-        // Compute derivative of the activation function with respect to the pre-activation
-        Matrix dActivation = applyActivationPrime(z);
-        
-        // Compute delta as the Hadamard product of dOutput and dActivation
-        Matrix delta = dOutput.hadamard(dActivation);
+        // delta = dOutput * activation'(z) in one pass, with the derivative taken from the outputs;
+        // for a linear activation, or logits output, delta is dOutput itself
+        const BasicMatrix<T> *delta = &dOutput;
+        bool logits = activation == activations::Activation::Softmax && logitsOutput;
+        if (activation != activations::Activation::Linear && !logits) {
+            this->delta.resize(dOutput.getRows(), dOutput.getCols());
+            activations::activationPrimeProduct(activation, outputs.getData(), dOutput.getData(), this->delta.getData(), dOutput.getSize());
+            delta = &this->delta;
+        }
 
         // Compute gradients with respect to the weights and biases
-        this->gradients["weights"] = inputs.transpose() * delta;
-        this->gradients["biases"] = delta.sum(0).transpose(); // column-wise sum and then transpose to match the shape of biases
+        // inputs^T * delta is computed in place without materializing the transpose
+        BasicMatrix<T>::gemm(inputs, true, *delta, false, *dWeights);
+        BasicMatrix<T>::sumInto(*delta, 0, *dBiases); // column-wise sum, kept in the (units, 1) shape of biases
 
         // Compute gradient with respect to the input
-        Matrix dInputs = delta * this->parameters["weights"].transpose();
+        BasicMatrix<T>::gemm(*delta, false, *weights, true, dInputs);
+
+        return dInputs;
+    }
+
+    template <typename T>
+    BasicConv2D<T>::BasicConv2D(int height, int width, int channels, int filters, int kernelSize, int stride, int padding, int dilation, const std::string &activation, std::unique_ptr<initializers::Initializer> kernel_initializer, std::unique_ptr<initializers::Initializer> bias_initializer) {
+        if (height <= 0 || width <= 0 || channels <= 0 || filters <= 0 || kernelSize <= 0 || stride <= 0 || dilation <= 0 || padding < 0) {
+            throw std::invalid_argument("Invalid Conv2D dimensions");
+        }
+        this->name = "Conv2D";
+        this->height = height;
+        this->width = width;
+        this->channels = channels;
+        this->filters = filters;
+        this->kernelSize = kernelSize;
+        this->stride = stride;
+        this->padding = padding;
+        this->dilation = dilation;
+        this->activation = activations::fromName(activation);
+        if (this->activation == activations::Activation::Softmax) {
+            throw std::invalid_argument("softmax is not supported by Conv2D");
+        }
+        int span = dilation * (kernelSize - 1) + 1; // extent of the dilated kernel
+        if (height + 2 * padding < span || width + 2 * padding < span) {
+            throw std::invalid_argument("Conv2D kernel is larger than the padded input");
+        }
+        outputHeight = (height + 2 * padding - span) / stride + 1;
+        outputWidth = (width + 2 * padding - span) / stride + 1;
+        this->inFeatures = height * width * channels;
+        this->outFeatures = outputHeight * outputWidth * filters;
+        this->kernel_initializer = std::move(kernel_initializer);
+        this->bias_initializer = std::move(bias_initializer);
+    }
+
+    template <typename T>
+    void BasicConv2D<T>::build() {
+        // weights is a matrix of shape (kernelSize * kernelSize * channels, filters), rows in (ky, kx, channel) order
+        // biases is a matrix of shape (filters,)
+        int patchSize = kernelSize * kernelSize * channels;
+        this->parameters["weights"] = BasicMatrix<T>(kernel_initializer->initialize(patchSize, filters));
+        this->parameters["biases"] = BasicMatrix<T>(bias_initializer->initialize(filters, 1));
+        this->gradients["weights"] = BasicMatrix<T>(patchSize, filters);
+        this->gradients["biases"] = BasicMatrix<T>(filters, 1);
+        lookUpParameters();
+    }
+
+    template <typename T>
+    void BasicConv2D<T>::lookUpParameters() {
+        weights = &this->parameters["weights"];
+        biases = &this->parameters["biases"];
+        dWeights = &this->gradients["weights"];
+        dBiases = &this->gradients["biases"];
+    }
+
+    template <typename T>
+    std::unique_ptr<BasicLayer<T>> BasicConv2D<T>::replicate(int) const {
+        auto replica = std::make_unique<BasicConv2D<T>>(*this);
+        replica->lookUpParameters();
+        return replica;
+    }
+
+    template <typename T>
+    int BasicConv2D<T>::getNumParameters() const {
+        return kernelSize * kernelSize * channels * filters + filters;
+    }
+
+    template <typename T>
+    int BasicConv2D<T>::getOutputHeight() const {
+        return outputHeight;
+    }
+
+    template <typename T>
+    int BasicConv2D<T>::getOutputWidth() const {
+        return outputWidth;
+    }
+
+    template <typename T>
+    int BasicConv2D<T>::getFilters() const {
+        return filters;
+    }
+
+    template <typename T>
+    bool BasicConv2D<T>::pointwise() const {
+        return kernelSize == 1 && stride == 1 && padding == 0;
+    }
+
+    template <typename T>
+    void BasicConv2D<T>::im2col(BasicMatrixView<T> inputs) {
+        // Row (n, oy, ox) of columns is the receptive field of output pixel (oy, ox) of image n, in the
+        // (ky, kx, channel) order of the weight rows; taps that fall in the padding are zero
+        int pixels = outputHeight * outputWidth;
+        int patchSize = kernelSize * kernelSize * channels;
+        columns.resize(inputs.getRows() * pixels, patchSize);
+        threads::parallelForRows(inputs.getRows(), pixels * patchSize, [&](int n) {
+            const T *image = inputs.row(n);
+            T *patch = columns.getData() + static_cast<size_t>(n) * pixels * patchSize;
+            for (int oy = 0; oy < outputHeight; oy++) {
+                for (int ox = 0; ox < outputWidth; ox++) {
+                    for (int ky = 0; ky < kernelSize; ky++) {
+                        int y = oy * stride - padding + ky * dilation;
+                        for (int kx = 0; kx < kernelSize; kx++) {
+                            int x = ox * stride - padding + kx * dilation;
+                            if (y < 0 || y >= height || x < 0 || x >= width) {
+                                std::fill(patch, patch + channels, T(0));
+                            } else {
+                                const T *pixel = image + (static_cast<size_t>(y) * width + x) * channels;
+                                std::copy(pixel, pixel + channels, patch);
+                            }
+                            patch += channels;
+                        }
+                    }
+                }
+            }
+        });
+    }
+
+    template <typename T>
+    void BasicConv2D<T>::col2im() {
+        // Adjoint of im2col: every patch gradient is added back onto the input pixels it was read from
+        int samples = dInputs.getRows();
+        int pixels = outputHeight * outputWidth;
+        int patchSize = kernelSize * kernelSize * channels;
+        threads::parallelForRows(samples, pixels * patchSize, [&](int n) {
+            T *image = dInputs.getData() + static_cast<size_t>(n) * this->inFeatures;
+            const T *patch = dColumns.getData() + static_cast<size_t>(n) * pixels * patchSize;
+            std::fill(image, image + this->inFeatures, T(0));
+            for (int oy = 0; oy < outputHeight; oy++) {
+                for (int ox = 0; ox < outputWidth; ox++) {
+                    for (int ky = 0; ky < kernelSize; ky++) {
+                        int y = oy * stride - padding + ky * dilation;
+                        for (int kx = 0; kx < kernelSize; kx++) {
+                            int x = ox * stride - padding + kx * dilation;
+                            if (y >= 0 && y < height && x >= 0 && x < width) {
+                                T *pixel = image + (static_cast<size_t>(y) * width + x) * channels;
+                                for (int c = 0; c < channels; c++) {
+                                    pixel[c] += patch[c];
+                                }
+                            }
+                            patch += channels;
+                        }
+                    }
+                }
+            }
+        });
+    }
+
+    template <typename T>
+    BasicMatrixView<T> BasicConv2D<T>::forward(BasicMatrixView<T> inputs) {
+        if (inputs.getCols() != this->inFeatures) {
+            throw std::invalid_argument("Conv2D inputs must have height * width * channels columns");
+        }
+        int samples = inputs.getRows();
+        if (pointwise() && inputs.isContiguous()) { // each input pixel is its own patch
+            patches = BasicMatrixView<T>(inputs.getData(), samples * height * width, channels);
+        } else {
+            im2col(inputs);
+            patches = columns;
+        }
+
+        // (samples * pixels, filters) in row-major order is (samples, pixels * filters) in NHWC, so the GEMM
+        // writes the outputs in place, with the bias and activation applied to each block as it is computed
+        BiasActivation<T> context{biases->getData(), activation};
+        litenet::gemm::Epilogue<T> fused{&biasActivationEpilogue<T>, &context};
+        BasicMatrix<T>::gemm(patches, false, *weights, false, outputs, 1, 0, &fused);
+        outputs.resize(samples, this->outFeatures);
+
+        if (!this->training) { // nothing is kept for backward
+            patches = BasicMatrixView<T>();
+            columns = BasicMatrix<T>();
+        }
+        return outputs;
+    }
+
+    template <typename T>
+    const BasicMatrix<T> &BasicConv2D<T>::backward(const BasicMatrix<T> &dOutput) {
+        if (!this->training) {
+            throw std::runtime_error("Conv2D::backward called in inference mode");
+        }
+        if (dOutput.getRows() != outputs.getRows() || dOutput.getCols() != outputs.getCols()) {
+            throw std::invalid_argument("Output gradient dimensions do not match the layer outputs");
+        }
+        int samples = outputs.getRows();
+        int rows = samples * outputHeight * outputWidth;
+
+        // delta = dOutput * activation'(z), viewed as (samples * pixels, filters) like the GEMM output
+        const T *deltaData = dOutput.getData();
+        if (activation != activations::Activation::Linear) {
+            delta.resize(rows, filters);
+            activations::activationPrimeProduct(activation, outputs.getData(), dOutput.getData(), delta.getData(), dOutput.getSize());
+            deltaData = delta.getData();
+        }
+        BasicMatrixView<T> deltaView(deltaData, rows, filters);
+
+        // Gradients with respect to the weights and biases
+        BasicMatrix<T>::gemm(patches, true, deltaView, false, *dWeights);
+        BasicMatrix<T>::sumInto(deltaView, 0, *dBiases);
+
+        // Gradient with respect to the inputs: patch gradients, folded back onto the pixels by col2im
+        if (patches.getData() != columns.getData()) { // pointwise: the patch gradients are the input gradients
+            BasicMatrix<T>::gemm(deltaView, false, *weights, true, dInputs);
+            dInputs.resize(samples, this->inFeatures);
+        } else {
+            BasicMatrix<T>::gemm(deltaView, false, *weights, true, dColumns);
+            dInputs.resize(samples, this->inFeatures);
+            col2im();
+        }
+        return dInputs;
+    }
+
+    template <typename T>
+    BasicPooling2D<T>::BasicPooling2D(int height, int width, int channels, int poolSize, int stride) {
+        if (height <= 0 || width <= 0 || channels <= 0 || poolSize <= 0 || stride < 0) {
+            throw std::invalid_argument("Invalid pooling dimensions");
+        }
+        if (poolSize > height || poolSize > width) {
+            throw std::invalid_argument("Pooling window is larger than the input");
+        }
+        this->height = height;
+        this->width = width;
+        this->channels = channels;
+        this->poolSize = poolSize;
+        this->stride = stride > 0 ? stride : poolSize;
+        outputHeight = (height - poolSize) / this->stride + 1;
+        outputWidth = (width - poolSize) / this->stride + 1;
+        this->inFeatures = height * width * channels;
+        this->outFeatures = outputHeight * outputWidth * channels;
+    }
+
+    template <typename T>
+    void BasicPooling2D<T>::build() {
+        // Nothing to do here
+    }
+
+    template <typename T>
+    int BasicPooling2D<T>::getNumParameters() const {
+        return 0;
+    }
+
+    template <typename T>
+    int BasicPooling2D<T>::getOutputHeight() const {
+        return outputHeight;
+    }
+
+    template <typename T>
+    int BasicPooling2D<T>::getOutputWidth() const {
+        return outputWidth;
+    }
+
+    template <typename T>
+    BasicMaxPooling2D<T>::BasicMaxPooling2D(int height, int width, int channels, int poolSize, int stride) : BasicPooling2D<T>(height, width, channels, poolSize, stride) {
+        this->name = "MaxPooling2D";
+    }
+
+    template <typename T>
+    std::unique_ptr<BasicLayer<T>> BasicMaxPooling2D<T>::replicate(int) const {
+        return std::make_unique<BasicMaxPooling2D<T>>(*this);
+    }
+
+    template <typename T>
+    BasicMatrixView<T> BasicMaxPooling2D<T>::forward(BasicMatrixView<T> inputs) {
+        if (inputs.getCols() != this->inFeatures) {
+            throw std::invalid_argument("Pooling inputs must have height * width * channels columns");
+        }
+        int samples = inputs.getRows();
+        int outFeatures = this->outFeatures;
+        int channels = this->channels;
+        this->outputs.resize(samples, outFeatures);
+        if (this->training) {
+            argmax.resize(static_cast<size_t>(samples) * outFeatures);
+        } else {
+            decltype(argmax)().swap(argmax); // nothing is kept for backward
+        }
+        bool keep = this->training;
+
+        // Windows are walked tap by tap with the channels innermost, so each step compares contiguous rows
+        // of channels and updates the running maximum and its position with selects the compiler vectorizes
+        threads::parallelForRows(samples, outFeatures * this->poolSize * this->poolSize, [&](int n) {
+            const T *image = inputs.row(n);
+            for (int oy = 0; oy < this->outputHeight; oy++) {
+                for (int ox = 0; ox < this->outputWidth; ox++) {
+                    size_t o = static_cast<size_t>(n) * outFeatures + (oy * this->outputWidth + ox) * channels;
+                    T *best = this->outputs.getData() + o;
+                    int *where = keep ? argmax.data() + o : nullptr;
+                    for (int ky = 0; ky < this->poolSize; ky++) {
+                        for (int kx = 0; kx < this->poolSize; kx++) {
+                            int tap = ((oy * this->stride + ky) * this->width + ox * this->stride + kx) * channels;
+                            const T *value = image + tap;
+                            if (ky == 0 && kx == 0) {
+                                std::copy(value, value + channels, best);
+                                if (where) {
+                                    for (int c = 0; c < channels; c++) {
+                                        where[c] = tap + c;
+                                    }
+                                }
+                            } else if (where) {
+                                for (int c = 0; c < channels; c++) {
+                                    bool greater = value[c] > best[c];
+                                    best[c] = greater ? value[c] : best[c];
+                                    where[c] = greater ? tap + c : where[c];
+                                }
+                            } else {
+                                for (int c = 0; c < channels; c++) {
+                                    best[c] = value[c] > best[c] ? value[c] : best[c];
+                                }
+                            }
+                        }
+                    }
+                }
+            }
+        });
+        return this->outputs;
+    }
+
+    template <typename T>
+    const BasicMatrix<T> &BasicMaxPooling2D<T>::backward(const BasicMatrix<T> &dOutput) {
+        if (!this->training) {
+            throw std::runtime_error("MaxPooling2D::backward called in inference mode");
+        }
+        if (dOutput.getRows() != this->outputs.getRows() || dOutput.getCols() != this->outputs.getCols()) {
+            throw std::invalid_argument("Output gradient dimensions do not match the layer outputs");
+        }
+        int samples = dOutput.getRows();
+        int inFeatures = this->inFeatures;
+        int outFeatures = this->outFeatures;
+        this->dInputs.resize(samples, inFeatures);
+        // Each gradient goes to the input that won its window; overlapping windows may share a winner
+        threads::parallelForRows(samples, inFeatures + outFeatures, [&](int n) {
+            T *dImage = this->dInputs.getData() + static_cast<size_t>(n) * inFeatures;
+            const T *dOut = dOutput.getData() + static_cast<size_t>(n) * outFeatures;
+            const int *where = argmax.data() + static_cast<size_t>(n) * outFeatures;
+            std::fill(dImage, dImage + inFeatures, T(0));
+            for (int o = 0; o < outFeatures; o++) {
+                dImage[where[o]] += dOut[o];
+            }
+        });
+        return this->dInputs;
+    }
+
+    template <typename T>
+    BasicAveragePooling2D<T>::BasicAveragePooling2D(int height, int width, int channels, int poolSize, int stride) : BasicPooling2D<T>(height, width, channels, poolSize, stride) {
+        this->name = "AveragePooling2D";
+    }
+
+    template <typename T>
+    std::unique_ptr<BasicLayer<T>> BasicAveragePooling2D<T>::replicate(int) const {
+        return std::make_unique<BasicAveragePooling2D<T>>(*this);
+    }
+
+    template <typename T>
+    BasicMatrixView<T> BasicAveragePooling2D<T>::forward(BasicMatrixView<T> inputs) {
+        if (inputs.getCols() != this->inFeatures) {
+            throw std::invalid_argument("Pooling inputs must have height * width * channels columns");
+        }
+        int samples = inputs.getRows();
+        int outFeatures = this->outFeatures;
+        int channels = this->channels;
+        T scale = T(1) / (this->poolSize * this->poolSize);
+        this->outputs.resize(samples, outFeatures);
+        threads::parallelForRows(samples, outFeatures * this->poolSize * this->poolSize, [&](int n) {
+            const T *image = inputs.row(n);
+            for (int oy = 0; oy < this->outputHeight; oy++) {
+                for (int ox = 0; ox < this->outputWidth; ox++) {
+                    T *sum = this->outputs.getData() + static_cast<size_t>(n) * outFeatures + (oy * this->outputWidth + ox) * channels;
+                    std::fill(sum, sum + channels, T(0));
+                    for (int ky = 0; ky < this->poolSize; ky++) {
+                        for (int kx = 0; kx < this->poolSize; kx++) {
+                            const T *value = image + ((oy * this->stride + ky) * this->width + ox * this->stride + kx) * channels;
+                            for (int c = 0; c < channels; c++) {
+                                sum[c] += value[c];
+                            }
+                        }
+                    }
+                    for (int c = 0; c < channels; c++) {
+                        sum[c] *= scale;
+                    }
+                }
+            }
+        });
+        return this->outputs;
+    }
+
+    template <typename T>
+    const BasicMatrix<T> &BasicAveragePooling2D<T>::backward(const BasicMatrix<T> &dOutput) {
+        if (!this->training) {
+            throw std::runtime_error("AveragePooling2D::backward called in inference mode");
+        }
+        if (dOutput.getRows() != this->outputs.getRows() || dOutput.getCols() != this->outputs.getCols()) {
+            throw std::invalid_argument("Output gradient dimensions do not match the layer outputs");
+        }
+        int samples = dOutput.getRows();
+        int inFeatures = this->inFeatures;
+        int outFeatures = this->outFeatures;
+        int channels = this->channels;
+        T scale = T(1) / (this->poolSize * this->poolSize);
+        this->dInputs.resize(samples, inFeatures);
+        // Every input of a window receives an equal share of the window's gradient
+        threads::parallelForRows(samples, inFeatures + outFeatures * this->poolSize * this->poolSize, [&](int n) {
+            T *dImage = this->dInputs.getData() + static_cast<size_t>(n) * inFeatures;
+            std::fill(dImage, dImage + inFeatures, T(0));
+            for (int oy = 0; oy < this->outputHeight; oy++) {
+                for (int ox = 0; ox < this->outputWidth; ox++) {
+                    const T *dOut = dOutput.getData() + static_cast<size_t>(n) * outFeatures + (oy * this->outputWidth + ox) * channels;
+                    for (int ky = 0; ky < this->poolSize; ky++) {
+                        for (int kx = 0; kx < this->poolSize; kx++) {
+                            T *dValue = dImage + ((oy * this->stride + ky) * this->width + ox * this->stride + kx) * channels;
+                            for (int c = 0; c < channels; c++) {
+                                dValue[c] += scale * dOut[c];
+                            }
+                        }
+                    }
+                }
+            }
+        });
+        return this->dInputs;
+    }
+
+    template <typename T>
+    BasicFlatten<T>::BasicFlatten() {
+        this->name = "Flatten";
+        this->inFeatures = 0;
+        this->outFeatures = 0;
+    }
+
+    template <typename T>
+    void BasicFlatten<T>::build() {
+        // Nothing to do here
+    }
+
+    template <typename T>
+    std::unique_ptr<BasicLayer<T>> BasicFlatten<T>::replicate(int) const {
+        return std::make_unique<BasicFlatten<T>>(*this);
+    }
+
+    template <typename T>
+    BasicMatrixView<T> BasicFlatten<T>::forward(BasicMatrixView<T> inputs) {
+        this->inFeatures = inputs.getCols();
+        this->outFeatures = inputs.getCols();
+        return inputs; // no copy: the rows already are the flattened samples
+    }
+
+    template <typename T>
+    const BasicMatrix<T> &BasicFlatten<T>::backward(const BasicMatrix<T> &dOutput) {
+        return dOutput;
+    }
+
+    template <typename T>
+    int BasicFlatten<T>::getNumParameters() const {
+        return 0;
+    }
+
+    template <typename T>
+    BasicBatchNormalization<T>::BasicBatchNormalization(int features, int channels, const std::string &activation, double momentum, double epsilon) {
+        if (channels == 0) {
+            channels = features;
+        }
+        if (features <= 0 || channels <= 0 || features % channels != 0) {
+            throw std::invalid_argument("BatchNormalization channels must divide the number of features");
+        }
+        this->name = "BatchNormalization";
+        this->inFeatures = features;
+        this->outFeatures = features;
+        this->channels = channels;
+        this->activation = activations::fromName(activation);
+        if (this->activation == activations::Activation::Softmax) {
+            throw std::invalid_argument("softmax is not supported by BatchNormalization");
+        }
+        this->momentum = momentum;
+        this->epsilon = epsilon;
+    }
+
+    template <typename T>
+    void BasicBatchNormalization<T>::build() {
+        // gamma and beta are matrices of shape (channels,), like Dense biases
+        this->parameters["gamma"] = BasicMatrix<T>(channels, 1, 1);
+        this->parameters["beta"] = BasicMatrix<T>(channels, 1);
+        this->gradients["gamma"] = BasicMatrix<T>(channels, 1);
+        this->gradients["beta"] = BasicMatrix<T>(channels, 1);
+        lookUpParameters();
+        runningMean = BasicMatrix<T>(channels, 1);
+        runningVariance = BasicMatrix<T>(channels, 1, 1);
+    }
+
+    template <typename T>
+    void BasicBatchNormalization<T>::lookUpParameters() {
+        gamma = &this->parameters["gamma"];
+        beta = &this->parameters["beta"];
+        dGamma = &this->gradients["gamma"];
+        dBeta = &this->gradients["beta"];
+    }
+
+    template <typename T>
+    std::unique_ptr<BasicLayer<T>> BasicBatchNormalization<T>::replicate(int) const {
+        auto replica = std::make_unique<BasicBatchNormalization<T>>(*this);
+        replica->lookUpParameters();
+        return replica;
+    }
+
+    template <typename T>
+    BasicMatrixView<T> BasicBatchNormalization<T>::forward(BasicMatrixView<T> inputs) {
+        if (inputs.getCols() != this->inFeatures) {
+            throw std::invalid_argument("BatchNormalization inputs do not match the number of features");
+        }
+        if (this->training && inputs.getRows() == 0) { // no batch statistics to normalize with
+            throw std::invalid_argument("BatchNormalization needs at least one sample in training");
+        }
+        if (folded && !this->training) { // the preceding Dense already applies this layer
+            return inputs;
+        }
+        int groups = this->inFeatures / channels; // pixels per sample for NHWC inputs, 1 otherwise
+        int rows = inputs.getRows() * groups; // each row holds one value per channel
+        auto row = [&](int r) { return inputs.row(r / groups) + (r % groups) * channels; };
+        mean.resize(channels);
+        inverseStd.resize(channels);
+        scale.resize(channels);
+        shift.resize(channels);
+
+        if (this->training) {
+            this->inputs = inputs;
+            // Sums of x - k and (x - k)^2 in one pass, with k the first row, which keeps the variance
+            // accurate when the mean is large compared with the spread
+            const T *first = row(0);
+            std::vector<double, memory::PoolAllocator<double>> sums(2 * channels);
+            reduceRows(rows, 2 * channels, partials, sums.data(), [&](int r, double *acc) {
+                const T *x = row(r);
+                for (int c = 0; c < channels; c++) {
+                    double d = static_cast<double>(x[c]) - first[c];
+                    acc[c] += d;
+                    acc[channels + c] += d * d;
+                }
+            });
+            for (int c = 0; c < channels; c++) {
+                double shifted = sums[c] / rows;
+                double variance = std::max(0.0, sums[channels + c] / rows - shifted * shifted);
+                mean[c] = first[c] + shifted;
+                inverseStd[c] = 1 / std::sqrt(variance + epsilon);
+                runningMean(c, 0) = static_cast<T>(momentum * runningMean(c, 0) + (1 - momentum) * mean[c]);
+                runningVariance(c, 0) = static_cast<T>(momentum * runningVariance(c, 0) + (1 - momentum) * variance);
+            }
+        } else {
+            this->inputs = BasicMatrixView<T>();
+            for (int c = 0; c < channels; c++) {
+                mean[c] = runningMean(c, 0);
+                inverseStd[c] = 1 / std::sqrt(static_cast<double>(runningVariance(c, 0)) + epsilon);
+            }
+        }
+
+        // Normalization, scale and shift as a single affine map per channel, then the activation
+        for (int c = 0; c < channels; c++) {
+            scale[c] = static_cast<T>((*gamma)(c, 0) * inverseStd[c]);
+            shift[c] = static_cast<T>((*beta)(c, 0) - mean[c] * (*gamma)(c, 0) * inverseStd[c]);
+        }
+        outputs.resize(inputs.getRows(), inputs.getCols());
+        threads::parallelForRows(rows, channels, [&](int r) {
+            const T *x = row(r);
+            T *y = outputs.getData() + static_cast<size_t>(r) * channels;
+            for (int c = 0; c < channels; c++) {
+                y[c] = x[c] * scale[c] + shift[c];
+            }
+            if (activation != activations::Activation::Linear) {
+                activations::biasActivation<T>(activation, nullptr, y, channels, 1, channels);
+            }
+        });
+        return outputs;
+    }
+
+    template <typename T>
+    const BasicMatrix<T> &BasicBatchNormalization<T>::backward(const BasicMatrix<T> &dOutput) {
+        if (!this->training) {
+            throw std::runtime_error("BatchNormalization::backward called in inference mode");
+        }
+        if (dOutput.getRows() != outputs.getRows() || dOutput.getCols() != outputs.getCols()) {
+            throw std::invalid_argument("Output gradient dimensions do not match the layer outputs");
+        }
+        int groups = this->inFeatures / channels;
+        int rows = dOutput.getRows() * groups;
+        auto row = [&](int r) { return inputs.row(r / groups) + (r % groups) * channels; };
+
+        // Gradient with respect to the normalized and scaled value
+        const T *dy = dOutput.getData();
+        if (activation != activations::Activation::Linear) {
+            delta.resize(dOutput.getRows(), dOutput.getCols());
+            activations::activationPrimeProduct(activation, outputs.getData(), dOutput.getData(), delta.getData(), dOutput.getSize());
+            dy = delta.getData();
+        }
+
+        // dBeta = sum(dy) and dGamma = sum(dy * xhat), with xhat = (x - mean) * inverseStd, in one pass
+        std::vector<double, memory::PoolAllocator<double>> sums(2 * channels);
+        reduceRows(rows, 2 * channels, partials, sums.data(), [&](int r, double *acc) {
+            const T *x = row(r);
+            const T *g = dy + static_cast<size_t>(r) * channels;
+            for (int c = 0; c < channels; c++) {
+                acc[c] += g[c];
+                acc[channels + c] += g[c] * ((x[c] - mean[c]) * inverseStd[c]);
+            }
+        });
+        for (int c = 0; c < channels; c++) {
+            (*dBeta)(c, 0) = static_cast<T>(sums[c]);
+            (*dGamma)(c, 0) = static_cast<T>(sums[channels + c]);
+        }
 
+        // dx = gamma * inverseStd * (dy - mean(dy) - xhat * mean(dy * xhat)), in a second pass
+        dInputs.resize(dOutput.getRows(), dOutput.getCols());
+        threads::parallelForRows(rows, channels, [&](int r) {
+            const T *x = row(r);
+            const T *g = dy + static_cast<size_t>(r) * channels;
+            T *dx = dInputs.getData() + static_cast<size_t>(r) * channels;
+            for (int c = 0; c < channels; c++) {
+                double xhat = (x[c] - mean[c]) * inverseStd[c];
+                dx[c] = static_cast<T>((*gamma)(c, 0) * inverseStd[c] * (g[c] - sums[c] / rows - xhat * sums[channels + c] / rows));
+            }
+        });
         return dInputs;
     }
 
-    Matrix Dense::applyActivation(const Matrix &m) {
-        if (activation == "sigmoid") {
-            return activations::sigmoid(m);
-        } else if (activation == "relu") {
-            return activations::relu(m);
-        } else if (activation == "leakyRelu") {
-            return activations::leakyRelu(m);
-        } else if (activation == "tanh") {
-            return activations::tanh(m);
-        } else if (activation == "softmax") {
-            return activations::softmax(m);
+    template <typename T>
+    void BasicBatchNormalization<T>::setTraining(bool training) {
+        BasicLayer<T>::setTraining(training);
+        if (training) {
+            folded = false;
         }
-        return m;
     }
 
-    Matrix Dense::applyActivationPrime(const Matrix &m) {
-        if (activation == "sigmoid") {
-            return activations::sigmoidPrime(m);
-        } else if (activation == "relu") {
-            return activations::reluPrime(m);
-        } else if (activation == "leakyRelu") {
-            return activations::leakyReluPrime(m);
-        } else if (activation == "tanh") {
-            return activations::tanhPrime(m);
-        } else if (activation == "softmax") {
-            return activations::softmaxPrime(m);
+    template <typename T>
+    void BasicBatchNormalization<T>::inferenceScaleShift(BasicMatrix<T> &scale, BasicMatrix<T> &shift) const {
+        scale.resize(channels, 1);
+        shift.resize(channels, 1);
+        for (int c = 0; c < channels; c++) {
+            double s = (*gamma)(c, 0) / std::sqrt(static_cast<double>(runningVariance(c, 0)) + epsilon);
+            scale(c, 0) = static_cast<T>(s);
+            shift(c, 0) = static_cast<T>((*beta)(c, 0) - runningMean(c, 0) * s);
         }
-        return m;
     }
 
-    Dropout::Dropout(float rate) {
+    template <typename T>
+    activations::Activation BasicBatchNormalization<T>::getActivation() const {
+        return activation;
+    }
+
+    template <typename T>
+    bool BasicBatchNormalization<T>::isPerFeature() const {
+        return channels == this->inFeatures;
+    }
+
+    template <typename T>
+    void BasicBatchNormalization<T>::setFolded(bool folded) {
+        this->folded = folded;
+    }
+
+    template <typename T>
+    const BasicMatrix<T> &BasicBatchNormalization<T>::getRunningMean() const {
+        return runningMean;
+    }
+
+    template <typename T>
+    const BasicMatrix<T> &BasicBatchNormalization<T>::getRunningVariance() const {
+        return runningVariance;
+    }
+
+    template <typename T>
+    BasicLayerNormalization<T>::BasicLayerNormalization(int features, double epsilon) {
+        if (features <= 0) {
+            throw std::invalid_argument("LayerNormalization needs at least one feature");
+        }
+        this->name = "LayerNormalization";
+        this->inFeatures = features;
+        this->outFeatures = features;
+        this->epsilon = epsilon;
+    }
+
+    template <typename T>
+    void BasicLayerNormalization<T>::build() {
+        // gamma and beta are matrices of shape (features,)
+        this->parameters["gamma"] = BasicMatrix<T>(this->inFeatures, 1, 1);
+        this->parameters["beta"] = BasicMatrix<T>(this->inFeatures, 1);
+        this->gradients["gamma"] = BasicMatrix<T>(this->inFeatures, 1);
+        this->gradients["beta"] = BasicMatrix<T>(this->inFeatures, 1);
+        lookUpParameters();
+    }
+
+    template <typename T>
+    void BasicLayerNormalization<T>::lookUpParameters() {
+        gamma = &this->parameters["gamma"];
+        beta = &this->parameters["beta"];
+        dGamma = &this->gradients["gamma"];
+        dBeta = &this->gradients["beta"];
+    }
+
+    template <typename T>
+    std::unique_ptr<BasicLayer<T>> BasicLayerNormalization<T>::replicate(int) const {
+        auto replica = std::make_unique<BasicLayerNormalization<T>>(*this);
+        replica->lookUpParameters();
+        return replica;
+    }
+
+    template <typename T>
+    BasicMatrixView<T> BasicLayerNormalization<T>::forward(BasicMatrixView<T> inputs) {
+        if (inputs.getCols() != this->inFeatures) {
+            throw std::invalid_argument("LayerNormalization inputs do not match the number of features");
+        }
+        int rows = inputs.getRows();
+        int features = this->inFeatures;
+        this->inputs = this->training ? inputs : BasicMatrixView<T>();
+        mean.resize(rows);
+        inverseStd.resize(rows);
+        outputs.resize(rows, features);
+        const T *g = gamma->getData();
+        const T *b = beta->getData();
+        // Statistics and normalization of a row while it is in cache
+        threads::parallelForRows(rows, features, [&](int i) {
+            const T *x = inputs.row(i);
+            T *y = outputs.getData() + static_cast<size_t>(i) * features;
+            double sum = 0;
+            for (int j = 0; j < features; j++) {
+                sum += x[j];
+            }
+            double mu = sum / features;
+            double squares = 0;
+            for (int j = 0; j < features; j++) {
+                double d = x[j] - mu;
+                squares += d * d;
+            }
+            T m = static_cast<T>(mu);
+            T s = static_cast<T>(1 / std::sqrt(squares / features + epsilon));
+            mean[i] = m;
+            inverseStd[i] = s;
+            for (int j = 0; j < features; j++) {
+                y[j] = (x[j] - m) * s * g[j] + b[j];
+            }
+        });
+        return outputs;
+    }
+
+    template <typename T>
+    const BasicMatrix<T> &BasicLayerNormalization<T>::backward(const BasicMatrix<T> &dOutput) {
+        if (!this->training) {
+            throw std::runtime_error("LayerNormalization::backward called in inference mode");
+        }
+        if (dOutput.getRows() != outputs.getRows() || dOutput.getCols() != outputs.getCols()) {
+            throw std::invalid_argument("Output gradient dimensions do not match the layer outputs");
+        }
+        int rows = dOutput.getRows();
+        int features = this->inFeatures;
+        const T *g = gamma->getData();
+        dInputs.resize(rows, features);
+        // Per row: dx = inverseStd * (gdy - mean(gdy) - xhat * mean(gdy * xhat)) with gdy = dy * gamma;
+        // the per-feature sums of dy * xhat (dGamma) and dy (dBeta) are accumulated in the same pass
+        std::vector<double, memory::PoolAllocator<double>> sums(2 * features);
+        reduceRows(rows, 2 * features, partials, sums.data(), [&](int i, double *acc) {
+            const T *x = inputs.row(i);
+            const T *dy = dOutput.getData() + static_cast<size_t>(i) * features;
+            T *dx = dInputs.getData() + static_cast<size_t>(i) * features;
+            T m = mean[i];
+            T s = inverseStd[i];
+            T sumG = 0;
+            T sumGX = 0;
+            for (int j = 0; j < features; j++) {
+                T xhat = (x[j] - m) * s;
+                T gdy = dy[j] * g[j];
+                sumG += gdy;
+                sumGX += gdy * xhat;
+                acc[j] += dy[j] * xhat;
+                acc[features + j] += dy[j];
+            }
+            T meanG = sumG / features;
+            T meanGX = sumGX / features;
+            for (int j = 0; j < features; j++) {
+                T xhat = (x[j] - m) * s;
+                dx[j] = s * (dy[j] * g[j] - meanG - xhat * meanGX);
+            }
+        });
+        for (int j = 0; j < features; j++) {
+            (*dGamma)(j, 0) = static_cast<T>(sums[j]);
+            (*dBeta)(j, 0) = static_cast<T>(sums[features + j]);
+        }
+        return dInputs;
+    }
+
+    template <typename T>
+    BasicEmbedding<T>::BasicEmbedding(int vocabularySize, int outputDim, int inputLength, std::unique_ptr<initializers::Initializer> embeddings_initializer) {
+        if (vocabularySize <= 0 || outputDim <= 0 || inputLength <= 0) {
+            throw std::invalid_argument("Invalid Embedding dimensions");
+        }
+        this->name = "Embedding";
+        this->vocabularySize = vocabularySize;
+        this->outputDim = outputDim;
+        this->inputLength = inputLength;
+        this->inFeatures = inputLength;
+        this->outFeatures = inputLength * outputDim;
+        this->embeddings_initializer = std::move(embeddings_initializer);
+    }
+
+    template <typename T>
+    void BasicEmbedding<T>::build() {
+        // embeddings is a matrix of shape (vocabularySize, outputDim), one row per token
+        this->parameters["embeddings"] = BasicMatrix<T>(embeddings_initializer->initialize(vocabularySize, outputDim));
+        this->sparseGradients["embeddings"] = SparseRows<T>();
+        lookUpParameters();
+        slots.assign(vocabularySize, -1);
+    }
+
+    template <typename T>
+    void BasicEmbedding<T>::lookUpParameters() {
+        embeddings = &this->parameters["embeddings"];
+        dEmbeddings = &this->sparseGradients["embeddings"];
+    }
+
+    template <typename T>
+    std::unique_ptr<BasicLayer<T>> BasicEmbedding<T>::replicate(int) const {
+        auto replica = std::make_unique<BasicEmbedding<T>>(*this);
+        replica->lookUpParameters();
+        return replica;
+    }
+
+    template <typename T>
+    int BasicEmbedding<T>::getNumParameters() const {
+        return vocabularySize * outputDim;
+    }
+
+    template <typename T>
+    BasicMatrixView<T> BasicEmbedding<T>::forward(BasicMatrixView<T> inputs) {
+        if (inputs.getCols() != inputLength) {
+            throw std::invalid_argument("Embedding inputs must have inputLength columns");
+        }
+        int samples = inputs.getRows();
+        indices.resize(static_cast<size_t>(samples) * inputLength);
+        for (int i = 0; i < samples; i++) {
+            for (int l = 0; l < inputLength; l++) {
+                T index = inputs(i, l);
+                if (!(index >= 0 && index < vocabularySize) || index != static_cast<T>(static_cast<int>(index))) {
+                    throw std::invalid_argument("Embedding index out of range");
+                }
+                indices[static_cast<size_t>(i) * inputLength + l] = static_cast<int>(index);
+            }
+        }
+
+        // Gather the rows of the table
+        outputs.resize(samples, this->outFeatures);
+        threads::parallelForRows(samples, this->outFeatures, [&](int i) {
+            T *out = outputs.getData() + static_cast<size_t>(i) * this->outFeatures;
+            for (int l = 0; l < inputLength; l++) {
+                const T *row = embeddings->getData() + static_cast<size_t>(indices[static_cast<size_t>(i) * inputLength + l]) * outputDim;
+                std::copy(row, row + outputDim, out + l * outputDim);
+            }
+        });
+        return outputs;
+    }
+
+    template <typename T>
+    const BasicMatrix<T> &BasicEmbedding<T>::backward(const BasicMatrix<T> &dOutput) {
+        if (!this->training) {
+            throw std::runtime_error("Embedding::backward called in inference mode");
+        }
+        if (dOutput.getRows() != outputs.getRows() || dOutput.getCols() != outputs.getCols()) {
+            throw std::invalid_argument("Output gradient dimensions do not match the layer outputs");
+        }
+        // Scatter-add the output gradient into one row per distinct token, in order of first occurrence
+        std::vector<int> &rows = dEmbeddings->rows;
+        rows.clear();
+        for (int index : indices) {
+            if (slots[index] < 0) {
+                slots[index] = static_cast<int>(rows.size());
+                rows.push_back(index);
+            }
+        }
+        BasicMatrix<T> &values = dEmbeddings->values;
+        values.resize(static_cast<int>(rows.size()), outputDim);
+        values.fill(0);
+        for (size_t k = 0; k < indices.size(); k++) {
+            const T *g = dOutput.getData() + k * outputDim; // occurrence k is sample k / inputLength, position k % inputLength
+            T *sum = values.getData() + static_cast<size_t>(slots[indices[k]]) * outputDim;
+            for (int j = 0; j < outputDim; j++) {
+                sum[j] += g[j];
+            }
+        }
+        for (int index : rows) {
+            slots[index] = -1;
+        }
+
+        dInputs.resize(dOutput.getRows(), inputLength);
+        dInputs.fill(0);
+        return dInputs;
+    }
+
+    template <typename T>
+    BasicRecurrent<T>::BasicRecurrent(const std::string &name, int gates, int timesteps, int inputDim, int units, bool returnSequences, int truncation, std::unique_ptr<initializers::Initializer> kernel_initializer, std::unique_ptr<initializers::Initializer> recurrent_initializer, std::unique_ptr<initializers::Initializer> bias_initializer) {
+        if (timesteps <= 0 || inputDim <= 0 || units <= 0 || truncation < 0) {
+            throw std::invalid_argument("Invalid " + name + " dimensions");
+        }
+        this->name = name;
+        this->gates = gates;
+        this->timesteps = timesteps;
+        this->inputDim = inputDim;
+        this->units = units;
+        this->returnSequences = returnSequences;
+        this->truncation = truncation;
+        this->inFeatures = timesteps * inputDim;
+        this->outFeatures = returnSequences ? timesteps * units : units;
+        this->kernel_initializer = std::move(kernel_initializer);
+        this->recurrent_initializer = std::move(recurrent_initializer);
+        this->bias_initializer = std::move(bias_initializer);
+    }
+
+    template <typename T>
+    void BasicRecurrent<T>::build() {
+        // The gates' weights are concatenated column-wise, units columns per gate
+        this->parameters["weights"] = BasicMatrix<T>(kernel_initializer->initialize(inputDim, gates * units));
+        this->parameters["recurrent_weights"] = BasicMatrix<T>(recurrent_initializer->initialize(units, gates * units));
+        this->parameters["biases"] = BasicMatrix<T>(bias_initializer->initialize(gates * units, 1));
+        this->gradients["weights"] = BasicMatrix<T>(inputDim, gates * units);
+        this->gradients["recurrent_weights"] = BasicMatrix<T>(units, gates * units);
+        this->gradients["biases"] = BasicMatrix<T>(gates * units, 1);
+        BasicRecurrent<T>::lookUpParameters();
+    }
+
+    template <typename T>
+    void BasicRecurrent<T>::lookUpParameters() {
+        weights = &this->parameters["weights"];
+        recurrentWeights = &this->parameters["recurrent_weights"];
+        biases = &this->parameters["biases"];
+        dWeights = &this->gradients["weights"];
+        dRecurrentWeights = &this->gradients["recurrent_weights"];
+        dBiases = &this->gradients["biases"];
+    }
+
+    template <typename T>
+    int BasicRecurrent<T>::getNumParameters() const {
+        return (inputDim + units + 1) * gates * units;
+    }
+
+    template <typename T>
+    BasicMatrixView<T> BasicRecurrent<T>::stepRows(const BasicMatrix<T> &m, int t, int timesteps) {
+        return BasicMatrixView<T>(m.getData() + static_cast<size_t>(t) * m.getCols(), m.getRows() / timesteps, m.getCols(), timesteps * m.getCols());
+    }
+
+    template <typename T>
+    BasicMatrixView<T> BasicRecurrent<T>::state(const BasicMatrix<T> &m, int t) const {
+        return BasicMatrixView<T>(m.getData() + static_cast<size_t>(t) * units, m.getRows(), units, m.getCols());
+    }
+
+    template <typename T>
+    const T *BasicRecurrent<T>::outputGradient(const BasicMatrix<T> &dOutput, int t) const {
+        if (returnSequences) {
+            return dOutput.getData() + static_cast<size_t>(t) * units;
+        }
+        return t == timesteps - 1 ? dOutput.getData() : nullptr;
+    }
+
+    template <typename T>
+    bool BasicRecurrent<T>::truncatedAt(int t) const {
+        return truncation > 0 && t % truncation == 0;
+    }
+
+    template <typename T>
+    BasicMatrixView<T> BasicRecurrent<T>::forward(BasicMatrixView<T> inputs) {
+        if (inputs.getCols() != this->inFeatures) {
+            throw std::invalid_argument(this->name + " inputs must have timesteps * inputDim columns");
+        }
+        int samples = inputs.getRows();
+        if (!inputs.isContiguous()) {
+            contiguousInputs = inputs;
+            inputs = contiguousInputs;
+        }
+        // Each (sample, step) becomes one row, so the input projections of every step are a single GEMM
+        BasicMatrixView<T> steps(inputs.getData(), samples * timesteps, inputDim);
+        this->inputs = this->training ? steps : BasicMatrixView<T>();
+        BiasActivation<T> context{biases->getData(), activations::Activation::Linear};
+        litenet::gemm::Epilogue<T> fused{&biasActivationEpilogue<T>, &context};
+        BasicMatrix<T>::gemm(steps, false, *weights, false, projections, 1, 0, &fused);
+
+        hidden.resize(samples, timesteps * units);
+        forwardSteps(samples);
+        if (returnSequences) {
+            return hidden;
+        }
+        last.resize(samples, units);
+        for (int i = 0; i < samples; i++) {
+            const T *h = hidden.getData() + static_cast<size_t>(i) * hidden.getCols() + static_cast<size_t>(timesteps - 1) * units;
+            std::copy(h, h + units, last.getData() + static_cast<size_t>(i) * units);
+        }
+        return last;
+    }
+
+    template <typename T>
+    const BasicMatrix<T> &BasicRecurrent<T>::backward(const BasicMatrix<T> &dOutput) {
+        if (!this->training) {
+            throw std::runtime_error(this->name + "::backward called in inference mode");
+        }
+        if (dOutput.getRows() != hidden.getRows() || dOutput.getCols() != this->outFeatures) {
+            throw std::invalid_argument("Output gradient dimensions do not match the layer outputs");
+        }
+        int samples = dOutput.getRows();
+        dGates.resize(samples * timesteps, gates * units);
+        backwardSteps(dOutput);
+
+        // The input-side gradients of all steps, like the projections, are single GEMMs
+        BasicMatrix<T>::gemm(inputs, true, dGates, false, *dWeights);
+        BasicMatrix<T>::sumInto(dGates, 0, *dBiases);
+        BasicMatrix<T>::gemm(dGates, false, *weights, true, dInputs);
+        dInputs.resize(samples, this->inFeatures); // (samples * timesteps, inputDim) rows are already in place
+        return dInputs;
+    }
+
+    template <typename T>
+    BasicLSTM<T>::BasicLSTM(int timesteps, int inputDim, int units, bool returnSequences, int truncation, std::unique_ptr<initializers::Initializer> kernel_initializer, std::unique_ptr<initializers::Initializer> recurrent_initializer, std::unique_ptr<initializers::Initializer> bias_initializer) : BasicRecurrent<T>("LSTM", 4, timesteps, inputDim, units, returnSequences, truncation, std::move(kernel_initializer), std::move(recurrent_initializer), std::move(bias_initializer)) {}
+
+    template <typename T>
+    void BasicLSTM<T>::build() {
+        BasicRecurrent<T>::build();
+        T *forgetBiases = this->biases->getData() + this->units;
+        for (int j = 0; j < this->units; j++) {
+            forgetBiases[j] += 1;
+        }
+    }
+
+    template <typename T>
+    std::unique_ptr<BasicLayer<T>> BasicLSTM<T>::replicate(int) const {
+        auto replica = std::make_unique<BasicLSTM<T>>(*this);
+        replica->lookUpParameters();
+        return replica;
+    }
+
+    template <typename T>
+    void BasicLSTM<T>::forwardSteps(int samples) {
+        int units = this->units;
+        int timesteps = this->timesteps;
+        cells.resize(samples, timesteps * units);
+        for (int t = 0; t < timesteps; t++) {
+            if (t > 0) {
+                BasicMatrix<T>::gemm(this->state(this->hidden, t - 1), false, *this->recurrentWeights, false, this->recurrent);
+            }
+            // One pass per sample: gate activations, then c = f * c' + i * g and h = o * tanh(c)
+            threads::parallelForRows(samples, 4 * units, [&](int n) {
+                T *a = this->projections.getData() + (static_cast<size_t>(n) * timesteps + t) * 4 * units;
+                const T *r = t > 0 ? this->recurrent.getData() + static_cast<size_t>(n) * 4 * units : nullptr;
+                size_t offset = static_cast<size_t>(n) * timesteps * units + static_cast<size_t>(t) * units;
+                T *c = cells.getData() + offset;
+                T *h = this->hidden.getData() + offset;
+                for (int j = 0; j < units; j++) {
+                    T i = gateSigmoid(a[j] + (r ? r[j] : 0));
+                    T f = gateSigmoid(a[units + j] + (r ? r[units + j] : 0));
+                    T g = std::tanh(a[2 * units + j] + (r ? r[2 * units + j] : 0));
+                    T o = gateSigmoid(a[3 * units + j] + (r ? r[3 * units + j] : 0));
+                    c[j] = i * g + (t > 0 ? f * c[j - units] : 0);
+                    h[j] = o * std::tanh(c[j]);
+                    a[j] = i;
+                    a[units + j] = f;
+                    a[2 * units + j] = g;
+                    a[3 * units + j] = o;
+                }
+            });
+        }
+    }
+
+    template <typename T>
+    void BasicLSTM<T>::backwardSteps(const BasicMatrix<T> &dOutput) {
+        int units = this->units;
+        int timesteps = this->timesteps;
+        int samples = dOutput.getRows();
+        this->dHidden.resize(samples, units);
+        this->dHidden.fill(0);
+        dCells.resize(samples, units);
+        dCells.fill(0);
+        this->dRecurrentWeights->fill(0);
+        for (int t = timesteps - 1; t >= 0; t--) {
+            const T *dOut = this->outputGradient(dOutput, t);
+            threads::parallelForRows(samples, 4 * units, [&](int n) {
+                size_t step = static_cast<size_t>(n) * timesteps + t;
+                const T *a = this->projections.getData() + step * 4 * units;
+                T *dz = this->dGates.getData() + step * 4 * units;
+                const T *c = cells.getData() + static_cast<size_t>(n) * timesteps * units + static_cast<size_t>(t) * units;
+                const T *dy = dOut ? dOut + static_cast<size_t>(n) * dOutput.getCols() : nullptr;
+                T *dh = this->dHidden.getData() + static_cast<size_t>(n) * units;
+                T *dc = dCells.getData() + static_cast<size_t>(n) * units;
+                for (int j = 0; j < units; j++) {
+                    T i = a[j], f = a[units + j], g = a[2 * units + j], o = a[3 * units + j];
+                    T tc = std::tanh(c[j]);
+                    T dH = dh[j] + (dy ? dy[j] : 0);
+                    T dC = dc[j] + dH * o * (1 - tc * tc);
+                    dz[j] = dC * g * i * (1 - i);
+                    dz[units + j] = t > 0 ? dC * c[j - units] * f * (1 - f) : 0;
+                    dz[2 * units + j] = dC * i * (1 - g * g);
+                    dz[3 * units + j] = dH * tc * o * (1 - o);
+                    dc[j] = dC * f;
+                }
+            });
+            if (t == 0) {
+                break;
+            }
+            BasicMatrixView<T> dz = BasicRecurrent<T>::stepRows(this->dGates, t, timesteps);
+            BasicMatrix<T>::gemm(this->state(this->hidden, t - 1), true, dz, false, *this->dRecurrentWeights, 1, 1);
+            if (this->truncatedAt(t)) {
+                this->dHidden.fill(0);
+                dCells.fill(0);
+            } else {
+                BasicMatrix<T>::gemm(dz, false, *this->recurrentWeights, true, this->dHidden);
+            }
+        }
+    }
+
+    template <typename T>
+    BasicGRU<T>::BasicGRU(int timesteps, int inputDim, int units, bool returnSequences, int truncation, std::unique_ptr<initializers::Initializer> kernel_initializer, std::unique_ptr<initializers::Initializer> recurrent_initializer, std::unique_ptr<initializers::Initializer> bias_initializer) : BasicRecurrent<T>("GRU", 3, timesteps, inputDim, units, returnSequences, truncation, std::move(kernel_initializer), std::move(recurrent_initializer), std::move(bias_initializer)) {}
+
+    template <typename T>
+    void BasicGRU<T>::build() {
+        BasicRecurrent<T>::build();
+        this->parameters["recurrent_biases"] = BasicMatrix<T>(this->bias_initializer->initialize(3 * this->units, 1));
+        this->gradients["recurrent_biases"] = BasicMatrix<T>(3 * this->units, 1);
+        lookUpParameters();
+    }
+
+    template <typename T>
+    void BasicGRU<T>::lookUpParameters() {
+        BasicRecurrent<T>::lookUpParameters();
+        recurrentBiases = &this->parameters["recurrent_biases"];
+        dRecurrentBiases = &this->gradients["recurrent_biases"];
+    }
+
+    template <typename T>
+    std::unique_ptr<BasicLayer<T>> BasicGRU<T>::replicate(int) const {
+        auto replica = std::make_unique<BasicGRU<T>>(*this);
+        replica->lookUpParameters();
+        return replica;
+    }
+
+    template <typename T>
+    int BasicGRU<T>::getNumParameters() const {
+        return BasicRecurrent<T>::getNumParameters() + 3 * this->units;
+    }
+
+    template <typename T>
+    void BasicGRU<T>::forwardSteps(int samples) {
+        int units = this->units;
+        int timesteps = this->timesteps;
+        candidates.resize(samples * timesteps, units);
+        const T *rb = recurrentBiases->getData();
+        for (int t = 0; t < timesteps; t++) {
+            if (t > 0) {
+                BasicMatrix<T>::gemm(this->state(this->hidden, t - 1), false, *this->recurrentWeights, false, this->recurrent);
+            }
+            // One pass per sample: gate activations, then h = (1 - z) * n + z * h'
+            threads::parallelForRows(samples, 3 * units, [&](int n) {
+                size_t step = static_cast<size_t>(n) * timesteps + t;
+                T *a = this->projections.getData() + step * 3 * units;
+                const T *r = t > 0 ? this->recurrent.getData() + static_cast<size_t>(n) * 3 * units : nullptr;
+                T *hn = candidates.getData() + step * units;
+                T *h = this->hidden.getData() + static_cast<size_t>(n) * timesteps * units + static_cast<size_t>(t) * units;
+                for (int j = 0; j < units; j++) {
+                    T z = gateSigmoid(a[j] + rb[j] + (r ? r[j] : 0));
+                    T reset = gateSigmoid(a[units + j] + rb[units + j] + (r ? r[units + j] : 0));
+                    hn[j] = rb[2 * units + j] + (r ? r[2 * units + j] : 0);
+                    T candidate = std::tanh(a[2 * units + j] + reset * hn[j]);
+                    h[j] = (1 - z) * candidate + (t > 0 ? z * h[j - units] : 0);
+                    a[j] = z;
+                    a[units + j] = reset;
+                    a[2 * units + j] = candidate;
+                }
+            });
+        }
+    }
+
+    template <typename T>
+    void BasicGRU<T>::backwardSteps(const BasicMatrix<T> &dOutput) {
+        int units = this->units;
+        int timesteps = this->timesteps;
+        int samples = dOutput.getRows();
+        this->dHidden.resize(samples, units);
+        this->dHidden.fill(0);
+        dRecurrentGates.resize(samples * timesteps, 3 * units);
+        this->dRecurrentWeights->fill(0);
+        for (int t = timesteps - 1; t >= 0; t--) {
+            const T *dOut = this->outputGradient(dOutput, t);
+            threads::parallelForRows(samples, 3 * units, [&](int n) {
+                size_t step = static_cast<size_t>(n) * timesteps + t;
+                const T *a = this->projections.getData() + step * 3 * units;
+                const T *hn = candidates.getData() + step * units;
+                const T *h = this->hidden.getData() + static_cast<size_t>(n) * timesteps * units + static_cast<size_t>(t) * units;
+                const T *dy = dOut ? dOut + static_cast<size_t>(n) * dOutput.getCols() : nullptr;
+                T *dx = this->dGates.getData() + step * 3 * units;
+                T *dr = dRecurrentGates.getData() + step * 3 * units;
+                T *dh = this->dHidden.getData() + static_cast<size_t>(n) * units;
+                for (int j = 0; j < units; j++) {
+                    T z = a[j], reset = a[units + j], candidate = a[2 * units + j];
+                    T previous = t > 0 ? h[j - units] : 0;
+                    T dH = dh[j] + (dy ? dy[j] : 0);
+                    T dCandidate = dH * (1 - z) * (1 - candidate * candidate);
+                    T dZ = dH * (previous - candidate) * z * (1 - z);
+                    T dReset = dCandidate * hn[j] * reset * (1 - reset);
+                    dx[j] = dZ;
+                    dx[units + j] = dReset;
+                    dx[2 * units + j] = dCandidate;
+                    dr[j] = dZ;
+                    dr[units + j] = dReset;
+                    dr[2 * units + j] = dCandidate * reset;
+                    dh[j] = dH * z; // the direct path to the previous state; the recurrent GEMM adds the rest
+                }
+            });
+            if (t == 0) {
+                break;
+            }
+            BasicMatrixView<T> dz = BasicRecurrent<T>::stepRows(dRecurrentGates, t, timesteps);
+            BasicMatrix<T>::gemm(this->state(this->hidden, t - 1), true, dz, false, *this->dRecurrentWeights, 1, 1);
+            if (this->truncatedAt(t)) {
+                this->dHidden.fill(0);
+            } else {
+                BasicMatrix<T>::gemm(dz, false, *this->recurrentWeights, true, this->dHidden, 1, 1);
+            }
+        }
+        BasicMatrix<T>::sumInto(dRecurrentGates, 0, *dRecurrentBiases);
+    }
+
+    template <typename T>
+    BasicDropout<T>::BasicDropout(float rate, uint64_t seed) {
+        if (!(rate >= 0 && rate < 1)) {
+            throw std::invalid_argument("Dropout rate must be in [0, 1)");
+        }
         this->name = "Dropout";
         this->rate = rate;
+        this->seed = seed != 0 ? seed : (uint64_t(std::random_device()()) << 32) | std::random_device()();
     }
 
-    void Dropout::build() {
+    template <typename T>
+    void BasicDropout<T>::build() {
         // Nothing to do here
     }
 
-    Matrix Dropout::forward(const Matrix &inputs) {
-        // Generate a mask with the same shape as the inputs
-        mask = randomUniform.initialize(inputs.getRows(), inputs.getCols());
-        for (int i = 0; i < mask.getRows(); i++) {
-            for (int j = 0; j < mask.getCols(); j++) {
-                mask(i, j) = mask(i, j) > rate ? 1 : 0;
-            }
+    template <typename T>
+    std::unique_ptr<BasicLayer<T>> BasicDropout<T>::replicate(int replica) const {
+        auto copy = std::make_unique<BasicDropout<T>>(*this);
+        uint64_t state = seed ^ static_cast<uint64_t>(replica);
+        copy->seed = random::splitMix64(state); // masks independent of the other replicas'
+        return copy;
+    }
+
+    template <typename T>
+    BasicMatrixView<T> BasicDropout<T>::forward(BasicMatrixView<T> inputs) {
+        // Inverted dropout: kept units are scaled by 1 / (1 - rate) while training, so inference is the identity
+        if (!this->training || rate == 0) {
+            return inputs;
         }
-        return inputs.hadamard(mask);
+        size_t n = inputs.getSize();
+        size_t words = (n + 63) / 64;
+        mask.resize(words);
+        outputs.resize(inputs.getRows(), inputs.getCols());
+        T scale = T(1) / (1 - rate);
+        // A unit is kept when a 32-bit uniform draw is at least rate * 2^32
+        uint64_t threshold = static_cast<uint64_t>(static_cast<double>(rate) * 4294967296.0);
+        uint64_t stream = step++;
+        const T *in = inputs.getData();
+        T *out = outputs.getData();
+        bool contiguous = inputs.isContiguous();
+
+        // Each chunk of mask words draws from its own generator, seeded by the chunk's first word, so the
+        // mask depends only on the seed and the call, not on the number of threads
+        threads::parallelFor(words, threads::grain / 64, [&](size_t begin, size_t end) {
+            random::Xoshiro256 generator(seed ^ begin, stream);
+            for (size_t w = begin; w < end; w++) {
+                uint64_t bits = 0;
+                for (int b = 0; b < 64; b += 2) { // two draws per 64-bit output
+                    uint64_t r = generator();
+                    bits |= uint64_t((r & 0xffffffff) >= threshold) << b;
+                    bits |= uint64_t((r >> 32) >= threshold) << (b + 1);
+                }
+                mask[w] = bits;
+                size_t first = w * 64;
+                int count = static_cast<int>(std::min<size_t>(64, n - first));
+                // Multiplying by the bit, rather than branching on it, avoids a mispredict per element
+                if (contiguous) {
+                    for (int b = 0; b < count; b++) {
+                        out[first + b] = in[first + b] * (scale * T((bits >> b) & 1));
+                    }
+                } else {
+                    for (int b = 0; b < count; b++) {
+                        out[first + b] = inputs.element(first + b) * (scale * T((bits >> b) & 1));
+                    }
+                }
+            }
+        });
+        return outputs;
     }
 
-    Matrix Dropout::backward(const Matrix &dOutput) {
-        return dOutput.hadamard(mask);
+    template <typename T>
+    const BasicMatrix<T> &BasicDropout<T>::backward(const BasicMatrix<T> &dOutput) {
+        if (!this->training) {
+            throw std::runtime_error("Dropout::backward called in inference mode");
+        }
+        if (rate == 0) {
+            return dOutput;
+        }
+        if (dOutput.getRows() != outputs.getRows() || dOutput.getCols() != outputs.getCols()) {
+            throw std::invalid_argument("Output gradient dimensions do not match the layer outputs");
+        }
+        size_t n = dOutput.getSize();
+        T scale = T(1) / (1 - rate);
+        dInputs.resize(dOutput.getRows(), dOutput.getCols());
+        const T *dOut = dOutput.getData();
+        T *dIn = dInputs.getData();
+        threads::parallelFor(mask.size(), threads::grain / 64, [&](size_t begin, size_t end) {
+            for (size_t w = begin; w < end; w++) {
+                uint64_t bits = mask[w];
+                size_t first = w * 64;
+                int count = static_cast<int>(std::min<size_t>(64, n - first));
+                for (int b = 0; b < count; b++) {
+                    dIn[first + b] = dOut[first + b] * (scale * T((bits >> b) & 1));
+                }
+            }
+        });
+        return dInputs;
     }
+
+    template class BasicLayer<double>;
+    template class BasicLayer<float>;
+    template class BasicDense<double>;
+    template class BasicDense<float>;
+    template class BasicConv2D<double>;
+    template class BasicConv2D<float>;
+    template class BasicPooling2D<double>;
+    template class BasicPooling2D<float>;
+    template class BasicMaxPooling2D<double>;
+    template class BasicMaxPooling2D<float>;
+    template class BasicAveragePooling2D<double>;
+    template class BasicAveragePooling2D<float>;
+    template class BasicFlatten<double>;
+    template class BasicFlatten<float>;
+    template class BasicBatchNormalization<double>;
+    template class BasicBatchNormalization<float>;
+    template class BasicLayerNormalization<double>;
+    template class BasicLayerNormalization<float>;
+    template class BasicEmbedding<double>;
+    template class BasicEmbedding<float>;
+    template class BasicRecurrent<double>;
+    template class BasicRecurrent<float>;
+    template class BasicLSTM<double>;
+    template class BasicLSTM<float>;
+    template class BasicGRU<double>;
+    template class BasicGRU<float>;
+    template class BasicDropout<double>;
+    template class BasicDropout<float>;
 }
\ No newline at end of file
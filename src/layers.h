@@ -10,50 +10,432 @@
 #include <string>
 #include <memory>
 #include <unordered_map>
+#include <cstdint>
 
 namespace litenet::layers {
-    class Layer {
+    // Layers are templates over the scalar type of their parameters and activations;
+    // Layer, Dense, Conv2D, the pooling, normalization and recurrent layers, Flatten, Embedding and Dropout
+    // are the double versions
+    // Gradient of a parameter matrix that only some rows receive, such as an embedding table:
+    // row rows[i] of the gradient is row i of values, and every other row is zero
+    template <typename T>
+    struct SparseRows {
+        std::vector<int> rows;
+        BasicMatrix<T> values;
+    };
+
+    template <typename T>
+    class BasicLayer {
         public:
-            Layer() {}
+            BasicLayer() {}
+            virtual ~BasicLayer() {}
             virtual void build() = 0;
-            virtual Matrix forward(const Matrix &inputs) = 0;
-            virtual Matrix backward(const Matrix &dOutput) = 0;
+            // forward returns a view and backward a reference to a buffer owned by the layer, valid until the
+            // next call; the buffers are reused so steady-state training does not allocate. Layers that only
+            // reinterpret their inputs (Flatten) return the inputs or the output gradient themselves.
+            // Layers may keep the view of their inputs for backward, so the inputs must outlive that call
+            virtual BasicMatrixView<T> forward(BasicMatrixView<T> inputs) = 0;
+            virtual const BasicMatrix<T> &backward(const BasicMatrix<T> &dOutput) = 0;
+            // In training mode (the default) forward keeps what backward needs; in inference mode it keeps
+            // nothing beyond its outputs, and backward must not be called
+            virtual void setTraining(bool training);
+            bool isTraining() const;
             std::string getName() const;
             int getInFeatures() const;
             int getOutFeatures() const;
-            int getNumParameters() const;
-            std::unordered_map<std::string, Matrix> parameters;
-            std::unordered_map<std::string, Matrix> gradients;
+            virtual int getNumParameters() const;
+            // A copy of this built layer, replica 1, 2, ... for data-parallel training, with its own gradients and
+            // buffers; Model then shares the parameters through the arena. Layers that draw random numbers give
+            // each replica its own stream. Throws unless overridden
+            virtual std::unique_ptr<BasicLayer<T>> replicate(int replica) const;
+            std::unordered_map<std::string, BasicMatrix<T>> parameters;
+            std::unordered_map<std::string, BasicMatrix<T>> gradients;
+            // Parameters listed here have a row-sparse gradient instead of an entry in gradients
+            std::unordered_map<std::string, SparseRows<T>> sparseGradients;
         protected:
             std::string name;
             int inFeatures;
             int outFeatures;
+            bool training = true;
+    };
+    template <typename T>
+    class BasicDense : public BasicLayer<T> {
+        public:
+            BasicDense(int inFeatures, int outFeatures, const std::string &activation = "linear", std::unique_ptr<initializers::Initializer> kernel_initializer = std::make_unique<initializers::GlorotUniform>(), std::unique_ptr<initializers::Initializer> bias_initializer = std::make_unique<initializers::Zeros>());
+            void build() override;
+            std::unique_ptr<BasicLayer<T>> replicate(int replica) const override;
+            BasicMatrixView<T> forward(BasicMatrixView<T> inputs) override;
+            const BasicMatrix<T> &backward(const BasicMatrix<T> &dOutput) override;    
+            void setTraining(bool training) override;
+            // For inference: replaces this layer's output z by activation(z * scale + shift), per unit, by
+            // folding the affine map into copies of the weights and biases; training mode drops the fold.
+            // Only valid for a linear activation (see canFold)
+            bool canFold() const;
+            void fold(const BasicMatrix<T> &scale, const BasicMatrix<T> &shift, activations::Activation activation);
+            activations::Activation getActivation() const;
+            // With a softmax activation and logits set, training outputs the logits and backward takes the
+            // gradient with respect to them, for a loss that applies the softmax itself
+            // (loss::softmaxCrossentropy); inference still outputs probabilities
+            void setLogitsOutput(bool logits);
+        private:
+            std::shared_ptr<initializers::Initializer> kernel_initializer; // shared by replicas
+            std::shared_ptr<initializers::Initializer> bias_initializer;
+            activations::Activation activation; // resolved from its name once, in the constructor
+            bool logitsOutput = false;
+            // Parameters and gradients, looked up in build (and again in a replica); references into the maps stay valid
+            void lookUpParameters();
+            BasicMatrix<T> *weights = nullptr;
+            BasicMatrix<T> *biases = nullptr;
+            BasicMatrix<T> *dWeights = nullptr;
+            BasicMatrix<T> *dBiases = nullptr;
+            BasicMatrixView<T> inputs;
+            BasicMatrix<T> outputs; // backward takes the activation derivative from the outputs, so z is never stored
+            BasicMatrix<T> delta;
+            BasicMatrix<T> dInputs;
+            bool folded = false;
+            BasicMatrix<T> foldedWeights;
+            BasicMatrix<T> foldedBiases;
+            activations::Activation foldedActivation;
+    };
+    // 2D convolution over a batch of images stored one per row in NHWC order: row n holds image n as
+    // height x width pixels in row-major order, each pixel being its channels side by side, so the row has
+    // height * width * channels columns. Outputs use the same layout with the filters as channels.
+    // Lowered to im2col + GEMM: each output pixel becomes one row of kernel patches, multiplied by the
+    // (kernelSize * kernelSize * channels, filters) weights.
+    template <typename T>
+    class BasicConv2D : public BasicLayer<T> {
+        public:
+            BasicConv2D(int height, int width, int channels, int filters, int kernelSize, int stride = 1, int padding = 0, int dilation = 1, const std::string &activation = "linear", std::unique_ptr<initializers::Initializer> kernel_initializer = std::make_unique<initializers::GlorotUniform>(), std::unique_ptr<initializers::Initializer> bias_initializer = std::make_unique<initializers::Zeros>());
+            void build() override;
+            std::unique_ptr<BasicLayer<T>> replicate(int replica) const override;
+            BasicMatrixView<T> forward(BasicMatrixView<T> inputs) override;
+            const BasicMatrix<T> &backward(const BasicMatrix<T> &dOutput) override;
+            int getNumParameters() const override;
+            int getOutputHeight() const;
+            int getOutputWidth() const;
+            int getFilters() const;
+        private:
+            std::shared_ptr<initializers::Initializer> kernel_initializer; // shared by replicas
+            std::shared_ptr<initializers::Initializer> bias_initializer;
+            activations::Activation activation;
+            int height, width, channels;
+            int filters, kernelSize, stride, padding, dilation;
+            int outputHeight, outputWidth;
+            void lookUpParameters();
+            BasicMatrix<T> *weights = nullptr;
+            BasicMatrix<T> *biases = nullptr;
+            BasicMatrix<T> *dWeights = nullptr;
+            BasicMatrix<T> *dBiases = nullptr;
+            // A 1x1 kernel with stride 1 and no padding needs no im2col: the inputs already are the patches
+            bool pointwise() const;
+            BasicMatrix<T> columns; // im2col buffer: (samples * output pixels, patch size)
+            BasicMatrixView<T> patches; // columns, or the inputs themselves when pointwise
+            BasicMatrix<T> outputs;
+            BasicMatrix<T> delta;
+            BasicMatrix<T> dColumns;
+            BasicMatrix<T> dInputs;
+            void im2col(BasicMatrixView<T> inputs);
+            void col2im();
+    };
+    // Pooling over poolSize x poolSize windows of NHWC images, channel by channel; the stride defaults to
+    // poolSize (non-overlapping windows) and windows that do not fit entirely in the image are dropped
+    template <typename T>
+    class BasicPooling2D : public BasicLayer<T> {
+        public:
+            BasicPooling2D(int height, int width, int channels, int poolSize = 2, int stride = 0);
+            void build() override;
+            int getNumParameters() const override;
+            int getOutputHeight() const;
+            int getOutputWidth() const;
+        protected:
+            int height, width, channels;
+            int poolSize, stride;
+            int outputHeight, outputWidth;
+            BasicMatrix<T> outputs;
+            BasicMatrix<T> dInputs;
+    };
+    // Keeps the maximum of each window and, in training mode, where it came from, found in the same pass,
+    // so backward routes each gradient straight to its input without revisiting the window
+    template <typename T>
+    class BasicMaxPooling2D : public BasicPooling2D<T> {
+        public:
+            BasicMaxPooling2D(int height, int width, int channels, int poolSize = 2, int stride = 0);
+            BasicMatrixView<T> forward(BasicMatrixView<T> inputs) override;
+            std::unique_ptr<BasicLayer<T>> replicate(int replica) const override;
+            const BasicMatrix<T> &backward(const BasicMatrix<T> &dOutput) override;
+        private:
+            std::vector<int, memory::PoolAllocator<int>> argmax; // per output element, its input column
+    };
+    template <typename T>
+    class BasicAveragePooling2D : public BasicPooling2D<T> {
+        public:
+            BasicAveragePooling2D(int height, int width, int channels, int poolSize = 2, int stride = 0);
+            BasicMatrixView<T> forward(BasicMatrixView<T> inputs) override;
+            std::unique_ptr<BasicLayer<T>> replicate(int replica) const override;
+            const BasicMatrix<T> &backward(const BasicMatrix<T> &dOutput) override;
+    };
+    // Images are already stored one flattened NHWC row per sample, so Flatten only marks where a model
+    // moves from image layers to Dense layers: forward returns its inputs and backward its output gradient
+    template <typename T>
+    class BasicFlatten : public BasicLayer<T> {
+        public:
+            BasicFlatten();
+            void build() override;
+            std::unique_ptr<BasicLayer<T>> replicate(int replica) const override;
+            BasicMatrixView<T> forward(BasicMatrixView<T> inputs) override;
+            const BasicMatrix<T> &backward(const BasicMatrix<T> &dOutput) override;
+            int getNumParameters() const override;
+    };
+    // Batch normalization: each feature (or, for NHWC images, each channel) is normalized with the mean and
+    // variance of the batch, then scaled by gamma and shifted by beta, and passed through an optional
+    // activation. Inference uses running averages of the batch statistics instead. Statistics and
+    // normalization take one pass each over the inputs, and so do the gradient sums and the input gradient.
+    // A Model in inference mode folds a per-feature BatchNormalization that directly follows a linear Dense
+    // into that Dense's weights, and the BatchNormalization then passes its inputs through unchanged
+    template <typename T>
+    class BasicBatchNormalization : public BasicLayer<T> {
+        public:
+            // features is the width of the input rows; channels, if nonzero, must divide it, and the
+            // statistics are then shared by the features with the same index modulo channels (NHWC)
+            BasicBatchNormalization(int features, int channels = 0, const std::string &activation = "linear", double momentum = 0.99, double epsilon = 1e-3);
+            void build() override;
+            std::unique_ptr<BasicLayer<T>> replicate(int replica) const override;
+            BasicMatrixView<T> forward(BasicMatrixView<T> inputs) override;
+            const BasicMatrix<T> &backward(const BasicMatrix<T> &dOutput) override;
+            void setTraining(bool training) override;
+            // Inference as an affine map per channel, z * scale + shift, followed by the activation
+            void inferenceScaleShift(BasicMatrix<T> &scale, BasicMatrix<T> &shift) const;
+            activations::Activation getActivation() const;
+            bool isPerFeature() const;
+            void setFolded(bool folded); // set by Model when a preceding Dense has absorbed this layer
+            const BasicMatrix<T> &getRunningMean() const;
+            const BasicMatrix<T> &getRunningVariance() const;
+        private:
+            int channels;
+            activations::Activation activation;
+            double momentum;
+            double epsilon;
+            bool folded = false;
+            void lookUpParameters();
+            BasicMatrix<T> *gamma = nullptr;
+            BasicMatrix<T> *beta = nullptr;
+            BasicMatrix<T> *dGamma = nullptr;
+            BasicMatrix<T> *dBeta = nullptr;
+            BasicMatrix<T> runningMean;
+            BasicMatrix<T> runningVariance;
+            BasicMatrixView<T> inputs;
+            std::vector<double, memory::PoolAllocator<double>> mean; // batch statistics per channel
+            std::vector<double, memory::PoolAllocator<double>> inverseStd;
+            std::vector<double, memory::PoolAllocator<double>> partials; // per-chunk sums of the reductions
+            std::vector<T, memory::PoolAllocator<T>> scale; // normalization as an affine map per channel
+            std::vector<T, memory::PoolAllocator<T>> shift;
+            BasicMatrix<T> outputs;
+            BasicMatrix<T> delta;
+            BasicMatrix<T> dInputs;
+    };
+    // Layer normalization: each sample (row) is normalized with its own mean and variance over all its
+    // features, then scaled by gamma and shifted by beta per feature; the same in training and inference.
+    // Each row is normalized while it is in cache, so forward and backward are one pass over the rows
+    // (plus the per-feature gradient sums of gamma and beta, which are accumulated in the same pass)
+    template <typename T>
+    class BasicLayerNormalization : public BasicLayer<T> {
+        public:
+            BasicLayerNormalization(int features, double epsilon = 1e-3);
+            void build() override;
+            std::unique_ptr<BasicLayer<T>> replicate(int replica) const override;
+            BasicMatrixView<T> forward(BasicMatrixView<T> inputs) override;
+            const BasicMatrix<T> &backward(const BasicMatrix<T> &dOutput) override;
+        private:
+            double epsilon;
+            void lookUpParameters();
+            BasicMatrix<T> *gamma = nullptr;
+            BasicMatrix<T> *beta = nullptr;
+            BasicMatrix<T> *dGamma = nullptr;
+            BasicMatrix<T> *dBeta = nullptr;
+            BasicMatrixView<T> inputs;
+            std::vector<T, memory::PoolAllocator<T>> mean; // per row
+            std::vector<T, memory::PoolAllocator<T>> inverseStd;
+            std::vector<double, memory::PoolAllocator<double>> partials;
+            BasicMatrix<T> outputs;
+            BasicMatrix<T> dInputs;
     };
-    class Dense : public Layer {
+    // Looks up a learned vector for each token index. Each input row holds inputLength indices, stored as
+    // scalars with integral values in [0, vocabularySize); the output row is their embeddings side by side,
+    // inputLength * outputDim columns. The gradient of the table is row-sparse (see SparseRows), so a
+    // training step touches only the rows of the tokens in the batch, whatever the vocabulary size
+    template <typename T>
+    class BasicEmbedding : public BasicLayer<T> {
         public:
-            Dense(int inFeatures, int outFeatures, const std::string &activation = "linear", std::unique_ptr<initializers::Initializer> kernel_initializer = std::make_unique<initializers::GlorotUniform>(), std::unique_ptr<initializers::Initializer> bias_initializer = std::make_unique<initializers::Zeros>());
+            BasicEmbedding(int vocabularySize, int outputDim, int inputLength = 1, std::unique_ptr<initializers::Initializer> embeddings_initializer = std::make_unique<initializers::RandomUniform>(-0.05, 0.05));
             void build() override;
-            Matrix forward(const Matrix &inputs) override;
-            Matrix backward(const Matrix &dOutput) override;    
+            std::unique_ptr<BasicLayer<T>> replicate(int replica) const override;
+            BasicMatrixView<T> forward(BasicMatrixView<T> inputs) override;
+            // The inputs are indices, so the returned input gradient is zero
+            const BasicMatrix<T> &backward(const BasicMatrix<T> &dOutput) override;
+            int getNumParameters() const override;
         private:
-            std::unique_ptr<initializers::Initializer> kernel_initializer;
-            std::unique_ptr<initializers::Initializer> bias_initializer;
-            std::string activation;
-            Matrix inputs;
-            Matrix applyActivation(const Matrix &m);
-            Matrix applyActivationPrime(const Matrix &m);
+            std::shared_ptr<initializers::Initializer> embeddings_initializer; // shared by replicas
+            int vocabularySize;
+            int outputDim;
+            int inputLength;
+            void lookUpParameters();
+            BasicMatrix<T> *embeddings = nullptr;
+            SparseRows<T> *dEmbeddings = nullptr;
+            std::vector<int, memory::PoolAllocator<int>> indices; // of the last forward, row by row
+            std::vector<int> slots; // per table row, its position in dEmbeddings->rows during backward, or -1
+            BasicMatrix<T> outputs;
+            BasicMatrix<T> dInputs;
+    };
+    // Base of the recurrent layers. Each input row is a sequence of timesteps steps of inputDim features side
+    // by side (timesteps * inputDim columns, the layout Embedding produces); the output row is the hidden
+    // state after the last step (units columns) or, with returnSequences, after every step (timesteps * units).
+    // The input projections of all steps are one GEMM, (samples * timesteps, inputDim) by (inputDim,
+    // gates * units), and each step then runs one GEMM of the previous hidden state by the concatenated
+    // recurrent weights of all gates, followed by one fused element-wise kernel for the gates and the state
+    // update. Backpropagation through time is truncated every truncation steps when truncation > 0: the
+    // gradient stops flowing back from step t to step t - 1 when t is a multiple of truncation
+    template <typename T>
+    class BasicRecurrent : public BasicLayer<T> {
+        public:
+            void build() override;
+            BasicMatrixView<T> forward(BasicMatrixView<T> inputs) override;
+            const BasicMatrix<T> &backward(const BasicMatrix<T> &dOutput) override;
+            int getNumParameters() const override;
+        protected:
+            BasicRecurrent(const std::string &name, int gates, int timesteps, int inputDim, int units, bool returnSequences, int truncation, std::unique_ptr<initializers::Initializer> kernel_initializer, std::unique_ptr<initializers::Initializer> recurrent_initializer, std::unique_ptr<initializers::Initializer> bias_initializer);
+            // Runs the recurrence over projections, turning each step's input projection into the gate
+            // activations kept for backward, and fills hidden
+            virtual void forwardSteps(int samples) = 0;
+            // Backpropagates dOutput through time into dGates, the gradient of the gate pre-activations, and
+            // sets the gradients of the recurrent parameters
+            virtual void backwardSteps(const BasicMatrix<T> &dOutput) = 0;
+            // Rows of step t of a matrix holding one row per (sample, step), sample-major: (samples, cols)
+            static BasicMatrixView<T> stepRows(const BasicMatrix<T> &m, int t, int timesteps);
+            // Hidden state or cell state after step t, (samples, units)
+            BasicMatrixView<T> state(const BasicMatrix<T> &m, int t) const;
+            // Output gradient at step t, or nullptr if the step has no output; advanced by units per sample
+            const T *outputGradient(const BasicMatrix<T> &dOutput, int t) const;
+            bool truncatedAt(int t) const;
+            int gates;
+            int timesteps;
+            int inputDim;
+            int units;
+            bool returnSequences;
+            int truncation;
+            std::shared_ptr<initializers::Initializer> kernel_initializer; // shared by replicas
+            std::shared_ptr<initializers::Initializer> recurrent_initializer;
+            std::shared_ptr<initializers::Initializer> bias_initializer;
+            virtual void lookUpParameters();
+            BasicMatrix<T> *weights = nullptr; // (inputDim, gates * units)
+            BasicMatrix<T> *recurrentWeights = nullptr; // (units, gates * units)
+            BasicMatrix<T> *biases = nullptr; // (gates * units, 1)
+            BasicMatrix<T> *dWeights = nullptr;
+            BasicMatrix<T> *dRecurrentWeights = nullptr;
+            BasicMatrix<T> *dBiases = nullptr;
+            BasicMatrixView<T> inputs; // (samples * timesteps, inputDim)
+            BasicMatrix<T> contiguousInputs; // copy of inputs that are not contiguous
+            BasicMatrix<T> projections; // (samples * timesteps, gates * units), gate activations after forwardSteps
+            BasicMatrix<T> recurrent; // previous hidden state times the recurrent weights, (samples, gates * units)
+            BasicMatrix<T> hidden; // (samples, timesteps * units), h_t in columns t * units onwards
+            BasicMatrix<T> last; // hidden state after the last step
+            BasicMatrix<T> dGates; // (samples * timesteps, gates * units)
+            BasicMatrix<T> dHidden; // gradient carried to the previous step, (samples, units)
+            BasicMatrix<T> dInputs;
     };
-    class Dropout : public Layer {
+    // Long short-term memory with input, forget, cell and output gates, in that order in the parameters.
+    // The forget gate starts open: its biases are initialized to 1 on top of bias_initializer
+    template <typename T>
+    class BasicLSTM : public BasicRecurrent<T> {
         public:
-            Dropout(float rate = 0.5);
+            BasicLSTM(int timesteps, int inputDim, int units, bool returnSequences = false, int truncation = 0, std::unique_ptr<initializers::Initializer> kernel_initializer = std::make_unique<initializers::GlorotUniform>(), std::unique_ptr<initializers::Initializer> recurrent_initializer = std::make_unique<initializers::GlorotUniform>(), std::unique_ptr<initializers::Initializer> bias_initializer = std::make_unique<initializers::Zeros>());
             void build() override;
-            Matrix forward(const Matrix &inputs) override;
-            Matrix backward(const Matrix &dOutput) override;
+            std::unique_ptr<BasicLayer<T>> replicate(int replica) const override;
+        protected:
+            void forwardSteps(int samples) override;
+            void backwardSteps(const BasicMatrix<T> &dOutput) override;
+        private:
+            BasicMatrix<T> cells; // (samples, timesteps * units), like hidden
+            BasicMatrix<T> dCells; // carried to the previous step, (samples, units)
+    };
+    // Gated recurrent unit with update, reset and candidate gates, in that order in the parameters. The reset
+    // gate applies after the recurrent product (as in cuDNN), so all three gates share one recurrent GEMM:
+    // n = tanh(x * Wn + bn + r * (h * Rn + rbn)), with separate input and recurrent biases
+    template <typename T>
+    class BasicGRU : public BasicRecurrent<T> {
+        public:
+            BasicGRU(int timesteps, int inputDim, int units, bool returnSequences = false, int truncation = 0, std::unique_ptr<initializers::Initializer> kernel_initializer = std::make_unique<initializers::GlorotUniform>(), std::unique_ptr<initializers::Initializer> recurrent_initializer = std::make_unique<initializers::GlorotUniform>(), std::unique_ptr<initializers::Initializer> bias_initializer = std::make_unique<initializers::Zeros>());
+            void build() override;
+            std::unique_ptr<BasicLayer<T>> replicate(int replica) const override;
+            int getNumParameters() const override;
+        protected:
+            void forwardSteps(int samples) override;
+            void backwardSteps(const BasicMatrix<T> &dOutput) override;
+        private:
+            void lookUpParameters() override;
+            BasicMatrix<T> *recurrentBiases = nullptr; // (3 * units, 1)
+            BasicMatrix<T> *dRecurrentBiases = nullptr;
+            BasicMatrix<T> candidates; // h * Rn + rbn per (sample, step), (samples * timesteps, units)
+            BasicMatrix<T> dRecurrentGates; // gradient of h * R + rb, (samples * timesteps, 3 * units)
+    };
+    template <typename T>
+    class BasicDropout : public BasicLayer<T> {
+        public:
+            // rate is the fraction of units dropped, in [0, 1); a seed of 0 draws one from std::random_device
+            BasicDropout(float rate = 0.5, uint64_t seed = 0);
+            void build() override;
+            std::unique_ptr<BasicLayer<T>> replicate(int replica) const override;
+            BasicMatrixView<T> forward(BasicMatrixView<T> inputs) override;
+            const BasicMatrix<T> &backward(const BasicMatrix<T> &dOutput) override;
         private:
             float rate;
-            Matrix mask;
-            initializers::RandomUniform randomUniform = initializers::RandomUniform(0, 1);
+            uint64_t seed;
+            uint64_t step = 0; // forward calls in training mode, the stream of each call's mask
+            std::vector<uint64_t, memory::PoolAllocator<uint64_t>> mask; // one bit per element, set for kept units
+            BasicMatrix<T> outputs;
+            BasicMatrix<T> dInputs;
     };
+
+    using Layer = BasicLayer<double>;
+    using Dense = BasicDense<double>;
+    using Conv2D = BasicConv2D<double>;
+    using MaxPooling2D = BasicMaxPooling2D<double>;
+    using AveragePooling2D = BasicAveragePooling2D<double>;
+    using Flatten = BasicFlatten<double>;
+    using BatchNormalization = BasicBatchNormalization<double>;
+    using LayerNormalization = BasicLayerNormalization<double>;
+    using Embedding = BasicEmbedding<double>;
+    using LSTM = BasicLSTM<double>;
+    using GRU = BasicGRU<double>;
+    using Dropout = BasicDropout<double>;
+
+    extern template class BasicLayer<double>;
+    extern template class BasicLayer<float>;
+    extern template class BasicDense<double>;
+    extern template class BasicDense<float>;
+    extern template class BasicConv2D<double>;
+    extern template class BasicConv2D<float>;
+    extern template class BasicPooling2D<double>;
+    extern template class BasicPooling2D<float>;
+    extern template class BasicMaxPooling2D<double>;
+    extern template class BasicMaxPooling2D<float>;
+    extern template class BasicAveragePooling2D<double>;
+    extern template class BasicAveragePooling2D<float>;
+    extern template class BasicFlatten<double>;
+    extern template class BasicFlatten<float>;
+    extern template class BasicBatchNormalization<double>;
+    extern template class BasicBatchNormalization<float>;
+    extern template class BasicLayerNormalization<double>;
+    extern template class BasicLayerNormalization<float>;
+    extern template class BasicEmbedding<double>;
+    extern template class BasicEmbedding<float>;
+    extern template class BasicRecurrent<double>;
+    extern template class BasicRecurrent<float>;
+    extern template class BasicLSTM<double>;
+    extern template class BasicLSTM<float>;
+    extern template class BasicGRU<double>;
+    extern template class BasicGRU<float>;
+    extern template class BasicDropout<double>;
+    extern template class BasicDropout<float>;
 }
 
 #endif
\ No newline at end of file
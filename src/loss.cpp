@@ -1,37 +1,117 @@
 #include "loss.h"
+#include "threads.h"
 #include <cmath>
+#include <algorithm>
 #include <stdexcept>
 
 namespace litenet::loss {
-    double meanSquaredError(const Matrix &predictions, const Matrix &targets) {
+    namespace {
+        // Checks that labels is a column of class ids for predictions with classes columns
+        template <typename T>
+        void validateLabels(BasicMatrixView<T> predictions, BasicMatrixView<T> labels) {
+            if (labels.getRows() != predictions.getRows() || labels.getCols() != 1) {
+                throw std::invalid_argument("labels must be a column with one class id per row of predictions");
+            }
+            for (int i = 0; i < labels.getRows(); i++) {
+                T id = labels(i, 0);
+                if (!(id >= 0 && id < predictions.getCols()) || id != static_cast<T>(static_cast<int>(id))) {
+                    throw std::invalid_argument("Class id out of range");
+                }
+            }
+        }
+
+        // Calls f(i) for each of rows rows of width cols and returns the sum of the results. Each chunk of rows
+        // adds into its own slot of a fixed array (there are at most maxChunks chunks, with boundaries that
+        // depend only on rows and cols), so the reduction does not allocate and does not depend on the number
+        // of threads
+        template <typename F>
+        double sumRows(int rows, int cols, const F &f) {
+            size_t rowsPerChunk = std::max<size_t>((rows + threads::maxChunks - 1) / threads::maxChunks, std::max<size_t>(1, threads::grain / std::max(1, cols)));
+            double partials[threads::maxChunks] = {};
+            threads::parallelFor(rows, rowsPerChunk, [&](size_t begin, size_t end) {
+                double sum = 0;
+                for (size_t i = begin; i < end; i++) {
+                    sum += f(static_cast<int>(i));
+                }
+                partials[begin / rowsPerChunk] = sum;
+            });
+            double total = 0;
+            for (double partial : partials) {
+                total += partial;
+            }
+            return total;
+        }
+    }
+
+    template <typename T>
+    double meanSquaredError(BasicMatrixView<T> predictions, BasicMatrixView<T> targets) {
         if (predictions.getRows() != targets.getRows() || predictions.getCols() != targets.getCols()) {
             throw std::invalid_argument("predictions and targets must have the same shape");
         }
-        return (predictions - targets).pow(2).sum() / predictions.getRows();
+        double sum = 0;
+        for (int i = 0; i < predictions.getRows(); i++) {
+            const T *p = predictions.row(i);
+            const T *t = targets.row(i);
+            for (int j = 0; j < predictions.getCols(); j++) {
+                double error = p[j] - t[j];
+                sum += error * error;
+            }
+        }
+        return sum / predictions.getRows();
     }
 
-    Matrix meanSquaredErrorPrime(const Matrix &predictions, const Matrix &targets) {
+    template <typename T>
+    BasicMatrix<T> meanSquaredErrorPrime(BasicMatrixView<T> predictions, BasicMatrixView<T> targets) {
+        BasicMatrix<T> result;
+        meanSquaredErrorPrime(predictions, targets, result);
+        return result;
+    }
+
+    template <typename T>
+    void meanSquaredErrorPrime(BasicMatrixView<T> predictions, BasicMatrixView<T> targets, BasicMatrix<T> &out) {
         if (predictions.getRows() != targets.getRows() || predictions.getCols() != targets.getCols()) {
             throw std::invalid_argument("predictions and targets must have the same shape");
         }
-        return 2 * (predictions - targets) / predictions.getRows();
+        BasicMatrix<T>::subtract(predictions, targets, out);
+        out *= 2;
+        out /= predictions.getRows();
     }
 
-    double meanAbsoluteError(const Matrix &predictions, const Matrix &targets) {
+    template <typename T>
+    double meanAbsoluteError(BasicMatrixView<T> predictions, BasicMatrixView<T> targets) {
         if (predictions.getRows() != targets.getRows() || predictions.getCols() != targets.getCols()) {
             throw std::invalid_argument("predictions and targets must have the same shape");
         }
-        return (predictions - targets).abs().sum() / predictions.getRows();
+        double sum = 0;
+        for (int i = 0; i < predictions.getRows(); i++) {
+            const T *p = predictions.row(i);
+            const T *t = targets.row(i);
+            for (int j = 0; j < predictions.getCols(); j++) {
+                sum += std::abs(p[j] - t[j]);
+            }
+        }
+        return sum / predictions.getRows();
+    }
+
+    template <typename T>
+    BasicMatrix<T> meanAbsoluteErrorPrime(BasicMatrixView<T> predictions, BasicMatrixView<T> targets) {
+        BasicMatrix<T> result;
+        meanAbsoluteErrorPrime(predictions, targets, result);
+        return result;
     }
 
-    Matrix meanAbsoluteErrorPrime(const Matrix &predictions, const Matrix &targets) {
+    template <typename T>
+    void meanAbsoluteErrorPrime(BasicMatrixView<T> predictions, BasicMatrixView<T> targets, BasicMatrix<T> &out) {
         if (predictions.getRows() != targets.getRows() || predictions.getCols() != targets.getCols()) {
             throw std::invalid_argument("predictions and targets must have the same shape");
         }
-        return (predictions - targets).sign() / predictions.getRows();
+        BasicMatrix<T>::subtract(predictions, targets, out);
+        out.applyInPlace([](T x) { return x > 0 ? T(1) : x < 0 ? T(-1) : T(0); });
+        out /= predictions.getRows();
     }
 
-    double binaryCrossentropy(const Matrix &predictions, const Matrix &targets) {
+    template <typename T>
+    double binaryCrossentropy(BasicMatrixView<T> predictions, BasicMatrixView<T> targets) {
         if (predictions.getRows() != targets.getRows() || predictions.getCols() != targets.getCols()) {
             throw std::invalid_argument("predictions and targets must have the same shape");
         }
@@ -47,23 +127,32 @@ namespace litenet::loss {
         return -crossentropy / predictions.getRows();
     }
 
-    Matrix binaryCrossentropyPrime(const Matrix &predictions, const Matrix &targets) {
+    template <typename T>
+    BasicMatrix<T> binaryCrossentropyPrime(BasicMatrixView<T> predictions, BasicMatrixView<T> targets) {
+        BasicMatrix<T> result;
+        binaryCrossentropyPrime(predictions, targets, result);
+        return result;
+    }
+
+    template <typename T>
+    void binaryCrossentropyPrime(BasicMatrixView<T> predictions, BasicMatrixView<T> targets, BasicMatrix<T> &out) {
         if (predictions.getRows() != targets.getRows() || predictions.getCols() != targets.getCols()) {
             throw std::invalid_argument("predictions and targets must have the same shape");
         }
-        Matrix result(predictions.getRows(), predictions.getCols());
-        const double epsilon = 1e-7;
+        out.resize(predictions.getRows(), predictions.getCols());
+        const T epsilon = 1e-7;
         for (int i = 0; i < predictions.getRows(); i++) {
             for (int j = 0; j < predictions.getCols(); j++) {
-                double p = predictions(i, j);
-                double t = targets(i, j);
-                result(i, j) = -(t / (p + epsilon)) + ((1 - t) / (1 - p + epsilon));
+                T p = predictions(i, j);
+                T t = targets(i, j);
+                out(i, j) = -(t / (p + epsilon)) + ((1 - t) / (1 - p + epsilon));
             }
         }
-        return result / predictions.getRows();
+        out /= predictions.getRows();
     }
 
-    double categoricalCrossentropy(const Matrix &predictions, const Matrix &targets) { // predictions is the output of the softmax function
+    template <typename T>
+    double categoricalCrossentropy(BasicMatrixView<T> predictions, BasicMatrixView<T> targets) { // predictions is the output of the softmax function
         if (predictions.getRows() != targets.getRows() || predictions.getCols() != targets.getCols()) {
             throw std::invalid_argument("predictions and targets must have the same shape");
         }
@@ -79,10 +168,127 @@ namespace litenet::loss {
         return -crossentropy / predictions.getRows();
     }
 
-    Matrix categoricalCrossentropyPrime(const Matrix &predictions, const Matrix &targets) { // predictions is the output of the softmax function
+    template <typename T>
+    BasicMatrix<T> categoricalCrossentropyPrime(BasicMatrixView<T> predictions, BasicMatrixView<T> targets) { // predictions is the output of the softmax function
+        BasicMatrix<T> result;
+        categoricalCrossentropyPrime(predictions, targets, result);
+        return result;
+    }
+
+    template <typename T>
+    void categoricalCrossentropyPrime(BasicMatrixView<T> predictions, BasicMatrixView<T> targets, BasicMatrix<T> &out) {
         if (predictions.getRows() != targets.getRows() || predictions.getCols() != targets.getCols()) {
             throw std::invalid_argument("predictions and targets must have the same shape");
         }
-        return (predictions - targets) / predictions.getRows();
+        BasicMatrix<T>::subtract(predictions, targets, out);
+        out /= predictions.getRows();
     }
+
+    template <typename T>
+    double softmaxCrossentropy(BasicMatrixView<T> logits, BasicMatrixView<T> targets, BasicMatrix<T> &dLogits) {
+        if (logits.getRows() != targets.getRows() || logits.getCols() != targets.getCols()) {
+            throw std::invalid_argument("logits and targets must have the same shape");
+        }
+        int rows = logits.getRows();
+        int cols = logits.getCols();
+        dLogits.resize(rows, cols);
+        T scale = T(1) / rows;
+        double crossentropy = sumRows(rows, cols, [&](int i) {
+            const T *z = logits.row(i);
+            const T *t = targets.row(i);
+            T *d = dLogits.getData() + static_cast<size_t>(i) * cols;
+            T max = z[0];
+            for (int j = 1; j < cols; j++) {
+                max = std::max(max, z[j]);
+            }
+            // exp(z - max) goes into d, then becomes the gradient once the sum is known
+            double sum = 0;
+            double targetSum = 0;
+            double dot = 0;
+            for (int j = 0; j < cols; j++) {
+                d[j] = std::exp(z[j] - max);
+                sum += d[j];
+                targetSum += t[j];
+                dot += static_cast<double>(t[j]) * (z[j] - max);
+            }
+            T inverse = static_cast<T>(1 / sum);
+            for (int j = 0; j < cols; j++) {
+                d[j] = (d[j] * inverse - t[j]) * scale;
+            }
+            return std::log(sum) * targetSum - dot;
+        });
+        return crossentropy / rows;
+    }
+
+    template <typename T>
+    double sparseCategoricalCrossentropy(BasicMatrixView<T> predictions, BasicMatrixView<T> labels) {
+        validateLabels(predictions, labels);
+        double crossentropy = 0;
+        const double epsilon = 1e-7;
+        for (int i = 0; i < predictions.getRows(); i++) {
+            crossentropy += std::log(predictions(i, static_cast<int>(labels(i, 0))) + epsilon);
+        }
+        return -crossentropy / predictions.getRows();
+    }
+
+    template <typename T>
+    void sparseCategoricalCrossentropyPrime(BasicMatrixView<T> predictions, BasicMatrixView<T> labels, BasicMatrix<T> &out) {
+        validateLabels(predictions, labels);
+        T scale = T(1) / predictions.getRows();
+        BasicMatrix<T>::scale(predictions, scale, out);
+        for (int i = 0; i < predictions.getRows(); i++) {
+            out(i, static_cast<int>(labels(i, 0))) -= scale;
+        }
+    }
+
+    template <typename T>
+    double sparseSoftmaxCrossentropy(BasicMatrixView<T> logits, BasicMatrixView<T> labels, BasicMatrix<T> &dLogits) {
+        validateLabels(logits, labels);
+        int rows = logits.getRows();
+        int cols = logits.getCols();
+        dLogits.resize(rows, cols);
+        T scale = T(1) / rows;
+        double crossentropy = sumRows(rows, cols, [&](int i) {
+            const T *z = logits.row(i);
+            int label = static_cast<int>(labels(i, 0));
+            T *d = dLogits.getData() + static_cast<size_t>(i) * cols;
+            T max = z[0];
+            for (int j = 1; j < cols; j++) {
+                max = std::max(max, z[j]);
+            }
+            double sum = 0;
+            for (int j = 0; j < cols; j++) {
+                d[j] = std::exp(z[j] - max);
+                sum += d[j];
+            }
+            T inverse = static_cast<T>(1 / sum) * scale;
+            for (int j = 0; j < cols; j++) {
+                d[j] *= inverse;
+            }
+            d[label] -= scale;
+            return std::log(sum) - (z[label] - max);
+        });
+        return crossentropy / rows;
+    }
+
+    #define LITENET_INSTANTIATE(T) \
+        template double meanSquaredError(BasicMatrixView<T>, BasicMatrixView<T>); \
+        template BasicMatrix<T> meanSquaredErrorPrime(BasicMatrixView<T>, BasicMatrixView<T>); \
+        template void meanSquaredErrorPrime(BasicMatrixView<T>, BasicMatrixView<T>, BasicMatrix<T> &); \
+        template double meanAbsoluteError(BasicMatrixView<T>, BasicMatrixView<T>); \
+        template BasicMatrix<T> meanAbsoluteErrorPrime(BasicMatrixView<T>, BasicMatrixView<T>); \
+        template void meanAbsoluteErrorPrime(BasicMatrixView<T>, BasicMatrixView<T>, BasicMatrix<T> &); \
+        template double binaryCrossentropy(BasicMatrixView<T>, BasicMatrixView<T>); \
+        template BasicMatrix<T> binaryCrossentropyPrime(BasicMatrixView<T>, BasicMatrixView<T>); \
+        template void binaryCrossentropyPrime(BasicMatrixView<T>, BasicMatrixView<T>, BasicMatrix<T> &); \
+        template double categoricalCrossentropy(BasicMatrixView<T>, BasicMatrixView<T>); \
+        template BasicMatrix<T> categoricalCrossentropyPrime(BasicMatrixView<T>, BasicMatrixView<T>); \
+        template void categoricalCrossentropyPrime(BasicMatrixView<T>, BasicMatrixView<T>, BasicMatrix<T> &); \
+        template double softmaxCrossentropy(BasicMatrixView<T>, BasicMatrixView<T>, BasicMatrix<T> &); \
+        template double sparseCategoricalCrossentropy(BasicMatrixView<T>, BasicMatrixView<T>); \
+        template void sparseCategoricalCrossentropyPrime(BasicMatrixView<T>, BasicMatrixView<T>, BasicMatrix<T> &); \
+        template double sparseSoftmaxCrossentropy(BasicMatrixView<T>, BasicMatrixView<T>, BasicMatrix<T> &);
+    LITENET_INSTANTIATE(double)
+    LITENET_INSTANTIATE(float)
+    #undef LITENET_INSTANTIATE
 }
\ No newline at end of file
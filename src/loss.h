@@ -3,15 +3,79 @@
 
 #include "matrix.h"
 
+// Instantiated for float and double; loss values are accumulated and returned in double.
+// Predictions and targets are read through views, so batches sliced from a larger matrix are not copied
 namespace litenet::loss {
-        double meanSquaredError(const Matrix &predictions, const Matrix &targets);
-        Matrix meanSquaredErrorPrime(const Matrix &predictions, const Matrix &targets);
-        double meanAbsoluteError(const Matrix &predictions, const Matrix &targets);
-        Matrix meanAbsoluteErrorPrime(const Matrix &predictions, const Matrix &targets);
-        double binaryCrossentropy(const Matrix &predictions, const Matrix &targets);
-        Matrix binaryCrossentropyPrime(const Matrix &predictions, const Matrix &targets);
-        double categoricalCrossentropy(const Matrix &predictions, const Matrix &targets);
-        Matrix categoricalCrossentropyPrime(const Matrix &predictions, const Matrix &targets);
+        template <typename T>
+        double meanSquaredError(BasicMatrixView<T> predictions, BasicMatrixView<T> targets);
+        template <typename T>
+        BasicMatrix<T> meanSquaredErrorPrime(BasicMatrixView<T> predictions, BasicMatrixView<T> targets);
+        template <typename T>
+        double meanAbsoluteError(BasicMatrixView<T> predictions, BasicMatrixView<T> targets);
+        template <typename T>
+        BasicMatrix<T> meanAbsoluteErrorPrime(BasicMatrixView<T> predictions, BasicMatrixView<T> targets);
+        template <typename T>
+        double binaryCrossentropy(BasicMatrixView<T> predictions, BasicMatrixView<T> targets);
+        template <typename T>
+        BasicMatrix<T> binaryCrossentropyPrime(BasicMatrixView<T> predictions, BasicMatrixView<T> targets);
+        template <typename T>
+        double categoricalCrossentropy(BasicMatrixView<T> predictions, BasicMatrixView<T> targets);
+        template <typename T>
+        BasicMatrix<T> categoricalCrossentropyPrime(BasicMatrixView<T> predictions, BasicMatrixView<T> targets);
+
+        // Softmax followed by categorical cross-entropy, fused: takes the logits z (the outputs before the
+        // softmax) and returns the mean over rows of logsumexp(z) * sum(t) - t . z, computed stably, while
+        // writing the exact gradient with respect to the logits, (softmax(z) - t) / rows, into dLogits
+        template <typename T>
+        double softmaxCrossentropy(BasicMatrixView<T> logits, BasicMatrixView<T> targets, BasicMatrix<T> &dLogits);
+
+        // Sparse categorical cross-entropy takes the targets as class ids instead of one-hot rows: labels is a
+        // (rows, 1) column holding one integral id in [0, classes) per row, stored as T like Embedding indices.
+        // The loss gathers one prediction per row, and the derivative, (predictions - onehot(labels)) / rows
+        // like categoricalCrossentropyPrime, subtracts at one element per row
+        template <typename T>
+        double sparseCategoricalCrossentropy(BasicMatrixView<T> predictions, BasicMatrixView<T> labels);
+        template <typename T>
+        void sparseCategoricalCrossentropyPrime(BasicMatrixView<T> predictions, BasicMatrixView<T> labels, BasicMatrix<T> &out);
+        // Fused softmax and sparse categorical cross-entropy, as softmaxCrossentropy with one-hot targets
+        template <typename T>
+        double sparseSoftmaxCrossentropy(BasicMatrixView<T> logits, BasicMatrixView<T> labels, BasicMatrix<T> &dLogits);
+
+        // Out-parameter overloads of the derivatives, writing into a reusable buffer
+        template <typename T>
+        void meanSquaredErrorPrime(BasicMatrixView<T> predictions, BasicMatrixView<T> targets, BasicMatrix<T> &out);
+        template <typename T>
+        void meanAbsoluteErrorPrime(BasicMatrixView<T> predictions, BasicMatrixView<T> targets, BasicMatrix<T> &out);
+        template <typename T>
+        void binaryCrossentropyPrime(BasicMatrixView<T> predictions, BasicMatrixView<T> targets, BasicMatrix<T> &out);
+        template <typename T>
+        void categoricalCrossentropyPrime(BasicMatrixView<T> predictions, BasicMatrixView<T> targets, BasicMatrix<T> &out);
+
+        // Matrix arguments are forwarded as views
+        template <typename T>
+        double meanSquaredError(const BasicMatrix<T> &predictions, const BasicMatrix<T> &targets) { return meanSquaredError(BasicMatrixView<T>(predictions), BasicMatrixView<T>(targets)); }
+        template <typename T>
+        BasicMatrix<T> meanSquaredErrorPrime(const BasicMatrix<T> &predictions, const BasicMatrix<T> &targets) { return meanSquaredErrorPrime(BasicMatrixView<T>(predictions), BasicMatrixView<T>(targets)); }
+        template <typename T>
+        double meanAbsoluteError(const BasicMatrix<T> &predictions, const BasicMatrix<T> &targets) { return meanAbsoluteError(BasicMatrixView<T>(predictions), BasicMatrixView<T>(targets)); }
+        template <typename T>
+        BasicMatrix<T> meanAbsoluteErrorPrime(const BasicMatrix<T> &predictions, const BasicMatrix<T> &targets) { return meanAbsoluteErrorPrime(BasicMatrixView<T>(predictions), BasicMatrixView<T>(targets)); }
+        template <typename T>
+        double binaryCrossentropy(const BasicMatrix<T> &predictions, const BasicMatrix<T> &targets) { return binaryCrossentropy(BasicMatrixView<T>(predictions), BasicMatrixView<T>(targets)); }
+        template <typename T>
+        BasicMatrix<T> binaryCrossentropyPrime(const BasicMatrix<T> &predictions, const BasicMatrix<T> &targets) { return binaryCrossentropyPrime(BasicMatrixView<T>(predictions), BasicMatrixView<T>(targets)); }
+        template <typename T>
+        double categoricalCrossentropy(const BasicMatrix<T> &predictions, const BasicMatrix<T> &targets) { return categoricalCrossentropy(BasicMatrixView<T>(predictions), BasicMatrixView<T>(targets)); }
+        template <typename T>
+        BasicMatrix<T> categoricalCrossentropyPrime(const BasicMatrix<T> &predictions, const BasicMatrix<T> &targets) { return categoricalCrossentropyPrime(BasicMatrixView<T>(predictions), BasicMatrixView<T>(targets)); }
+        template <typename T>
+        void meanSquaredErrorPrime(const BasicMatrix<T> &predictions, const BasicMatrix<T> &targets, BasicMatrix<T> &out) { meanSquaredErrorPrime(BasicMatrixView<T>(predictions), BasicMatrixView<T>(targets), out); }
+        template <typename T>
+        void meanAbsoluteErrorPrime(const BasicMatrix<T> &predictions, const BasicMatrix<T> &targets, BasicMatrix<T> &out) { meanAbsoluteErrorPrime(BasicMatrixView<T>(predictions), BasicMatrixView<T>(targets), out); }
+        template <typename T>
+        void binaryCrossentropyPrime(const BasicMatrix<T> &predictions, const BasicMatrix<T> &targets, BasicMatrix<T> &out) { binaryCrossentropyPrime(BasicMatrixView<T>(predictions), BasicMatrixView<T>(targets), out); }
+        template <typename T>
+        void categoricalCrossentropyPrime(const BasicMatrix<T> &predictions, const BasicMatrix<T> &targets, BasicMatrix<T> &out) { categoricalCrossentropyPrime(BasicMatrixView<T>(predictions), BasicMatrixView<T>(targets), out); }
 }
 
 #endif
\ No newline at end of file
@@ -1,237 +1,242 @@
 #include "matrix.h"
+#include "gemm.h"
+#include "simd.h"
+#include "threads.h"
 
 #include <iostream>
 #include <random>
+#include <algorithm>
 
 namespace litenet {
-    Matrix::Matrix() : rows(0), cols(0) {}
+    namespace {
+        // Element-wise SIMD kernels over n contiguous scalars, split across the thread pool when large
+        template <typename T>
+        void parallelKernel(void (*kernel)(const T *, const T *, T *, size_t), const T *a, const T *b, T *out, size_t n) {
+            threads::parallelFor(n, threads::grain, [&](size_t begin, size_t end) {
+                kernel(a + begin, b + begin, out + begin, end - begin);
+            });
+        }
+
+        template <typename T>
+        void parallelKernel(void (*kernel)(const T *, T, T *, size_t), const T *a, T scalar, T *out, size_t n) {
+            threads::parallelFor(n, threads::grain, [&](size_t begin, size_t end) {
+                kernel(a + begin, scalar, out + begin, end - begin);
+            });
+        }
+
+        // Runs an element-wise SIMD kernel over two views, as one flat range when both are contiguous
+        // and row by row otherwise; out is a contiguous rows x cols buffer
+        template <typename T>
+        void elementWise(void (*kernel)(const T *, const T *, T *, size_t), BasicMatrixView<T> a, BasicMatrixView<T> b, T *out) {
+            if (a.isContiguous() && b.isContiguous()) {
+                parallelKernel(kernel, a.getData(), b.getData(), out, a.getSize());
+                return;
+            }
+            threads::parallelForRows(a.getRows(), a.getCols(), [&](int i) {
+                kernel(a.row(i), b.row(i), out + static_cast<size_t>(i) * a.getCols(), a.getCols());
+            });
+        }
+
+        // Broadcast vectors are read as n contiguous scalars, whether they are stored as a row or a column
+        template <typename T>
+        const T *vectorData(BasicMatrixView<T> v, int n) {
+            if ((v.getRows() != 1 && v.getCols() != 1) || v.getSize() != static_cast<size_t>(n) || !v.isContiguous()) {
+                throw std::invalid_argument("Vector dimensions are not compatible for broadcasting");
+            }
+            return v.getData();
+        }
+
+        // Whether a view reads from the storage of a matrix that is about to be resized or overwritten
+        template <typename T>
+        bool overlaps(BasicMatrixView<T> view, const BasicMatrix<T> &m) {
+            const T *begin = m.getData();
+            return view.getSize() > 0 && view.getData() >= begin && view.getData() < begin + m.getSize();
+        }
+    }
+
+    template <typename T>
+    BasicMatrix<T>::BasicMatrix() : rows(0), cols(0) {}
 
-    Matrix::Matrix(int rows, int cols) : rows(rows), cols(cols), data(rows * cols) {}
+    template <typename T>
+    BasicMatrix<T>::BasicMatrix(int rows, int cols) : rows(rows), cols(cols), data(rows * cols) {}
 
-    Matrix::Matrix(int rows, int cols, double value) : rows(rows), cols(cols), data(rows * cols, value) {}
+    template <typename T>
+    BasicMatrix<T>::BasicMatrix(int rows, int cols, T value) : rows(rows), cols(cols), data(rows * cols, value) {}
 
-    Matrix::Matrix(const Matrix &m) : rows(m.rows), cols(m.cols), data(m.data) {}
+    template <typename T>
+    BasicMatrix<T>::BasicMatrix(const BasicMatrix &m) : rows(m.rows), cols(m.cols), data(m.data) {}
 
-    Matrix::~Matrix() {
-        data.clear();
+    template <typename T>
+    BasicMatrix<T>::BasicMatrix(BasicMatrix &&m) noexcept : rows(m.rows), cols(m.cols), data(std::move(m.data)) {
+        m.rows = 0;
+        m.cols = 0;
     }
 
-    Matrix &Matrix::operator=(const Matrix &m) {
+    template <typename T>
+    BasicMatrix<T>::~BasicMatrix() {}
+
+    template <typename T>
+    BasicMatrix<T> &BasicMatrix<T>::operator=(const BasicMatrix &m) {
         if (this != &m) {
+            data = m.data; // first: bound storage throws if the size differs
             rows = m.rows;
             cols = m.cols;
-            data = m.data;
         }
         return *this;
     }
 
-    double &Matrix::operator()(int i, int j) {
-        return data[i * cols + j];
-    }
-
-    double Matrix::operator()(int i, int j) const {
-        return data[i * cols + j];
-    }
-
-    int Matrix::getRows() const {
-        return rows;
-    }
-
-    int Matrix::getCols() const {
-        return cols;
+    template <typename T>
+    BasicMatrix<T> &BasicMatrix<T>::operator=(BasicMatrix &&m) noexcept {
+        if (this != &m) {
+            bool copies = data.isBound(); // bound storage takes a copy of the contents and m keeps its own
+            data = std::move(m.data);
+            rows = m.rows;
+            cols = m.cols;
+            if (!copies) {
+                m.rows = 0;
+                m.cols = 0;
+            }
+        }
+        return *this;
     }
 
-    std::vector<int> Matrix::getShape() const {
-        return {rows, cols};
+    template <typename T>
+    void BasicMatrix<T>::bind(T *storage) {
+        data.bind(storage);
     }
 
-    Matrix Matrix::operator+(const Matrix &m) const { // Element-wise addition
-        if (rows != m.rows || cols != m.cols) {
-            throw std::invalid_argument("Matrix dimensions are not compatible for addition");
-        }
-        Matrix result(rows, cols);
-        for (size_t i = 0; i < rows * cols; i++) {
-            result.data[i] = data[i] + m.data[i];
-        }
-        return result;
+    template <typename T>
+    bool BasicMatrix<T>::isBound() const {
+        return data.isBound();
     }
 
-    Matrix Matrix::operator+(double scalar) const { // Scalar addition
-        Matrix result(rows, cols);
-        for (size_t i = 0; i < rows * cols; i++) {
-            result.data[i] = data[i] + scalar;
-        }
-        return result;
+    template <typename T>
+    T &BasicMatrix<T>::operator()(int i, int j) {
+        return data[i * cols + j];
     }
 
-    Matrix operator+(double scalar, const Matrix &m) { // Scalar addition
-        return m + scalar;
+    template <typename T>
+    T BasicMatrix<T>::operator()(int i, int j) const {
+        return data[i * cols + j];
     }
 
-    Matrix Matrix::operator-(const Matrix &m) const { // Element-wise subtraction
-        if (rows != m.rows || cols != m.cols) {
-            throw std::invalid_argument("Matrix dimensions are not compatible for subtraction");
-        }
-        Matrix result(rows, cols);
-        for (size_t i = 0; i < rows * cols; i++) {
-            result.data[i] = data[i] - m.data[i];
-        }
-        return result;
+    template <typename T>
+    int BasicMatrix<T>::getRows() const {
+        return rows;
     }
 
-    Matrix Matrix::operator-(double scalar) const { // Scalar subtraction
-        Matrix result(rows, cols);
-        for (size_t i = 0; i < rows * cols; i++) {
-            result.data[i] = data[i] - scalar;
-        }
-        return result;
+    template <typename T>
+    int BasicMatrix<T>::getCols() const {
+        return cols;
     }
 
-    Matrix operator-(double scalar, const Matrix &m) { // Scalar subtraction
-        return -m + scalar;
+    template <typename T>
+    size_t BasicMatrix<T>::getSize() const {
+        return data.size();
     }
 
-    Matrix Matrix::operator*(const Matrix &m) const { // Matrix multiplication (dot product)
-        if (cols != m.rows) {
-            throw std::invalid_argument("Matrix dimensions are not compatible for multiplication");
-        }
-        Matrix result(rows, m.cols);
-        for (size_t i = 0; i < rows; i++) {
-            for (size_t j = 0; j < m.cols; j++) {
-                for (size_t k = 0; k < cols; k++) {
-                    result(i, j) += data[i * cols + k] * m(k, j);
-                }
-            }
-        }
-        return result;
+    template <typename T>
+    T *BasicMatrix<T>::getData() {
+        return data.data();
     }
 
-    Matrix Matrix::operator*(double factor) const { // Scalar multiplication
-        Matrix result(rows, cols);
-        for (size_t i = 0; i < rows * cols; i++) {
-            result.data[i] = data[i] * factor;
-        }
-        return result;
+    template <typename T>
+    const T *BasicMatrix<T>::getData() const {
+        return data.data();
     }
 
-    Matrix operator*(double factor, const Matrix &m) { // Scalar multiplication
-        return m * factor;
-    }    
-
-    Matrix Matrix::operator/(double factor) const { // Scalar division
-        if (factor == 0) {
-            throw std::invalid_argument("Division by zero");
-        }
-        Matrix result(rows, cols);
-        for (size_t i = 0; i < rows * cols; i++) {
-            result.data[i] = data[i] / factor;
-        }
-        return result;
+    template <typename T>
+    std::vector<int> BasicMatrix<T>::getShape() const {
+        return {rows, cols};
     }
 
-    Matrix Matrix::operator/(const Matrix &m) const { // Element-wise division
-        if (rows != m.rows || cols != m.cols) {
-            throw std::invalid_argument("Matrix dimensions are not compatible for division");
-        }
-        Matrix result(rows, cols);
-        for (size_t i = 0; i < rows * cols; i++) {
-            if (m.data[i] == 0) {
-                throw std::invalid_argument("Division by zero");
-            }
-            result.data[i] = data[i] / m.data[i];
-        }
-        return result;
+    template <typename T>
+    void BasicMatrix<T>::resize(int rows, int cols) { // keeps the allocation when shrinking or when the size is unchanged
+        this->rows = rows;
+        this->cols = cols;
+        data.resize(rows * cols);
     }
 
-    Matrix Matrix::operator-() const { // Unary minus
-        Matrix result(rows, cols);
-        for (size_t i = 0; i < rows * cols; i++) {
-            result.data[i] = -data[i];
+    template <typename T>
+    BasicMatrix<T> BasicMatrix<T>::operator*(const BasicMatrix &m) const { // Matrix multiplication (dot product)
+        if (cols != m.rows) {
+            throw std::invalid_argument("Matrix dimensions are not compatible for multiplication");
         }
+        BasicMatrix result(rows, m.cols);
+        litenet::gemm::multiply<T>(false, false, rows, m.cols, cols, 1, data.data(), cols, m.data.data(), m.cols, 0, result.data.data(), m.cols);
         return result;
     }
 
-    Matrix &Matrix::operator+=(const Matrix &m) { // Element-wise addition assignment
+    template <typename T>
+    BasicMatrix<T> &BasicMatrix<T>::operator+=(const BasicMatrix &m) { // Element-wise addition assignment
         if (rows != m.rows || cols != m.cols) {
             throw std::invalid_argument("Matrix dimensions are not compatible for addition");
         }
-        for (size_t i = 0; i < rows * cols; i++) {
-            data[i] += m.data[i];
-        }
+        parallelKernel(simd::kernels<T>().add, data.data(), m.data.data(), data.data(), data.size());
         return *this;
     }
 
-    Matrix &Matrix::operator+=(double scalar) { // Scalar addition assignment
-        for (size_t i = 0; i < rows * cols; i++) {
-            data[i] += scalar;
-        }
+    template <typename T>
+    BasicMatrix<T> &BasicMatrix<T>::operator+=(T scalar) { // Scalar addition assignment
+        parallelKernel(simd::kernels<T>().addScalar, data.data(), scalar, data.data(), data.size());
         return *this;
     }
 
-    Matrix &Matrix::operator-=(const Matrix &m) { // Element-wise subtraction assignment
+    template <typename T>
+    BasicMatrix<T> &BasicMatrix<T>::operator-=(const BasicMatrix &m) { // Element-wise subtraction assignment
         if (rows != m.rows || cols != m.cols) {
             throw std::invalid_argument("Matrix dimensions are not compatible for subtraction");
         }
-        for (size_t i = 0; i < rows * cols; i++) {
-            data[i] -= m.data[i];
-        }
+        parallelKernel(simd::kernels<T>().sub, data.data(), m.data.data(), data.data(), data.size());
         return *this;
     }
 
-    Matrix &Matrix::operator-=(double scalar) { // Scalar subtraction assignment
-        for (size_t i = 0; i < rows * cols; i++) {
-            data[i] -= scalar;
-        }
+    template <typename T>
+    BasicMatrix<T> &BasicMatrix<T>::operator-=(T scalar) { // Scalar subtraction assignment
+        parallelKernel(simd::kernels<T>().addScalar, data.data(), -scalar, data.data(), data.size());
         return *this;
     }
 
-    Matrix &Matrix::operator*=(const Matrix &m) { // Matrix multiplication assignment
+    template <typename T>
+    BasicMatrix<T> &BasicMatrix<T>::operator*=(const BasicMatrix &m) { // Matrix multiplication assignment
         if (cols != m.rows) {
             throw std::invalid_argument("Matrix dimensions are not compatible for multiplication");
         }
-        Matrix result(rows, m.cols);
-        for (size_t i = 0; i < rows; i++) {
-            for (size_t j = 0; j < m.cols; j++) {
-                for (size_t k = 0; k < cols; k++) {
-                    result(i, j) += data[i * cols + k] * m(k, j);
-                }
-            }
-        }
-        *this = result;
+        BasicMatrix result(rows, m.cols);
+        litenet::gemm::multiply<T>(false, false, rows, m.cols, cols, 1, data.data(), cols, m.data.data(), m.cols, 0, result.data.data(), m.cols);
+        *this = std::move(result);
         return *this;
     }
 
-    Matrix &Matrix::operator*=(double factor) { // Scalar multiplication assignment
-        for (size_t i = 0; i < rows * cols; i++) {
-            data[i] *= factor;
-        }
+    template <typename T>
+    BasicMatrix<T> &BasicMatrix<T>::operator*=(T factor) { // Scalar multiplication assignment
+        parallelKernel(simd::kernels<T>().mulScalar, data.data(), factor, data.data(), data.size());
         return *this;
     }
 
-    Matrix &Matrix::operator/=(double factor) { // Scalar division assignment
+    template <typename T>
+    BasicMatrix<T> &BasicMatrix<T>::operator/=(T factor) { // Scalar division assignment
         if (factor == 0) {
             throw std::invalid_argument("Division by zero");
         }
-        for (size_t i = 0; i < rows * cols; i++) {
-            data[i] /= factor;
-        }
+        parallelKernel(simd::kernels<T>().divScalar, data.data(), factor, data.data(), data.size());
         return *this;
     }
 
-    Matrix &Matrix::operator/=(const Matrix &m) { // Element-wise division assignment
+    template <typename T>
+    BasicMatrix<T> &BasicMatrix<T>::operator/=(const BasicMatrix &m) { // Element-wise division assignment
         if (rows != m.rows || cols != m.cols) {
             throw std::invalid_argument("Matrix dimensions are not compatible for division");
         }
-        for (size_t i = 0; i < rows * cols; i++) {
-            if (m.data[i] == 0) {
-                throw std::invalid_argument("Division by zero");
-            }
-            data[i] /= m.data[i];
+        if (std::find(m.data.begin(), m.data.end(), 0.0) != m.data.end()) {
+            throw std::invalid_argument("Division by zero");
         }
+        parallelKernel(simd::kernels<T>().div, data.data(), m.data.data(), data.data(), data.size());
         return *this;
     }
 
-    bool Matrix::operator==(const Matrix &m) const {
+    template <typename T>
+    bool BasicMatrix<T>::operator==(const BasicMatrix &m) const {
         if (rows != m.rows || cols != m.cols) {
             return false;
         }
@@ -243,128 +248,204 @@ namespace litenet {
         return true;
     }
 
-    bool Matrix::operator!=(const Matrix &m) const {
+    template <typename T>
+    bool BasicMatrix<T>::operator!=(const BasicMatrix &m) const {
         return !(*this == m);
     }
 
-    Matrix Matrix::hadamard(const Matrix &m) const {
-        if (rows != m.rows || cols != m.cols) {
-            throw std::invalid_argument("Matrix dimensions are not compatible for Hadamard product");
-        }
-        Matrix result(rows, cols);
-        for (size_t i = 0; i < rows * cols; i++) {
-            result.data[i] = data[i] * m.data[i];
-        }
+    template <typename T>
+    BasicMatrix<T> BasicMatrix<T>::transposeMultiply(const BasicMatrix &m) const { // this^T * m without materializing the transpose
+        BasicMatrix result;
+        gemm(*this, true, m, false, result);
         return result;
     }
 
-    Matrix Matrix::transpose() const {
-        Matrix result(cols, rows);
-        for (size_t i = 0; i < rows; i++) {
-            for (size_t j = 0; j < cols; j++) {
-                result(j, i) = data[i * cols + j];
-            }
-        }
+    template <typename T>
+    BasicMatrix<T> BasicMatrix<T>::multiplyTranspose(const BasicMatrix &m) const { // this * m^T without materializing the transpose
+        BasicMatrix result;
+        gemm(*this, false, m, true, result);
         return result;
     }
 
-    Matrix Matrix::normalize() const {
-        double s = sum();
-        if (s == 0) {
-            throw std::invalid_argument("Normalization of zero vector");
+    template <typename T>
+    void BasicMatrix<T>::gemm(BasicMatrixView<T> a, bool transA, BasicMatrixView<T> b, bool transB, BasicMatrix &c, T alpha, T beta, const litenet::gemm::Epilogue<T> *epilogue) { // c = alpha * op(a) * op(b) + beta * c
+        int m = transA ? a.getCols() : a.getRows();
+        int k = transA ? a.getRows() : a.getCols();
+        int n = transB ? b.getRows() : b.getCols();
+        if ((transB ? b.getCols() : b.getRows()) != k) {
+            throw std::invalid_argument("Matrix dimensions are not compatible for multiplication");
         }
-        Matrix result(rows, cols);
-        for (size_t i = 0; i < rows * cols; i++) {
-            result.data[i] = data[i] / s;
+        if (overlaps(a, c) || overlaps(b, c)) { // output aliases an input
+            BasicMatrix result = beta == 0 ? BasicMatrix() : c;
+            gemm(a, transA, b, transB, result, alpha, beta, epilogue);
+            c = std::move(result);
+            return;
         }
-        return result;
+        if (c.rows != m || c.cols != n) {
+            if (beta != 0) {
+                throw std::invalid_argument("Output matrix dimensions are not compatible for accumulation");
+            }
+            c.resize(m, n);
+        }
+        litenet::gemm::multiply<T>(transA, transB, m, n, k, alpha, a.getData(), a.getStride(), b.getData(), b.getStride(), beta, c.data.data(), c.cols, epilogue);
     }
 
-    Matrix Matrix::pow(double exponent) const {
-        Matrix result(rows, cols);
-        for (size_t i = 0; i < rows * cols; i++) {
-            result.data[i] = std::pow(data[i], exponent);
+    template <typename T>
+    void BasicMatrix<T>::add(BasicMatrixView<T> a, BasicMatrixView<T> b, BasicMatrix &out) {
+        if (a.getRows() != b.getRows() || a.getCols() != b.getCols()) {
+            throw std::invalid_argument("Matrix dimensions are not compatible for addition");
         }
-        return result;
+        out.resize(a.getRows(), a.getCols());
+        elementWise(simd::kernels<T>().add, a, b, out.data.data());
     }
 
-    Matrix Matrix::sqrt() const {
-        Matrix result(rows, cols);
-        for (size_t i = 0; i < rows * cols; i++) {
-            result.data[i] = std::sqrt(data[i]);
+    template <typename T>
+    void BasicMatrix<T>::subtract(BasicMatrixView<T> a, BasicMatrixView<T> b, BasicMatrix &out) {
+        if (a.getRows() != b.getRows() || a.getCols() != b.getCols()) {
+            throw std::invalid_argument("Matrix dimensions are not compatible for subtraction");
         }
-        return result;
+        out.resize(a.getRows(), a.getCols());
+        elementWise(simd::kernels<T>().sub, a, b, out.data.data());
     }
 
-    Matrix Matrix::abs() const {
-        Matrix result(rows, cols);
-        for (size_t i = 0; i < rows * cols; i++) {
-            result.data[i] = std::abs(data[i]);
+    template <typename T>
+    void BasicMatrix<T>::hadamard(BasicMatrixView<T> a, BasicMatrixView<T> b, BasicMatrix &out) {
+        if (a.getRows() != b.getRows() || a.getCols() != b.getCols()) {
+            throw std::invalid_argument("Matrix dimensions are not compatible for Hadamard product");
         }
-        return result;
+        out.resize(a.getRows(), a.getCols());
+        elementWise(simd::kernels<T>().mul, a, b, out.data.data());
     }
 
-    Matrix Matrix::sign() const {
-        Matrix result(rows, cols);
-        for (size_t i = 0; i < rows * cols; i++) {
-            result.data[i] = data[i] > 0 ? 1 : data[i] < 0 ? -1 : 0;
+    template <typename T>
+    void BasicMatrix<T>::scale(BasicMatrixView<T> a, T factor, BasicMatrix &out) {
+        out.resize(a.getRows(), a.getCols());
+        if (a.isContiguous()) {
+            parallelKernel(simd::kernels<T>().mulScalar, a.getData(), factor, out.data.data(), a.getSize());
+            return;
         }
-        return result;
+        threads::parallelForRows(a.getRows(), a.getCols(), [&](int i) {
+            simd::kernels<T>().mulScalar(a.row(i), factor, out.data.data() + static_cast<size_t>(i) * a.getCols(), a.getCols());
+        });
     }
 
-    Matrix Matrix::log(double base) const {
-        Matrix result(rows, cols);
-        for (size_t i = 0; i < rows * cols; i++) {
-            result.data[i] = std::log(data[i]) / std::log(base);
-        }
-        return result;
+    template <typename T>
+    void BasicMatrix<T>::mulInto(BasicMatrixView<T> m, BasicMatrix &out) const { // out = this * m
+        gemm(*this, false, m, false, out);
     }
 
-    double Matrix::Matrix::sum() const {
-        double s = 0;
-        for (size_t i = 0; i < rows * cols; i++) {
-            s += data[i];
+    template <typename T>
+    void BasicMatrix<T>::addRowVector(BasicMatrixView<T> a, BasicMatrixView<T> row, BasicMatrix &out) {
+        const T *v = vectorData(row, a.getCols());
+        out.resize(a.getRows(), a.getCols());
+        threads::parallelForRows(a.getRows(), a.getCols(), [&](int i) {
+            simd::kernels<T>().add(a.row(i), v, &out.data[i * out.cols], out.cols);
+        });
+    }
+
+    template <typename T>
+    void BasicMatrix<T>::mulRowVector(BasicMatrixView<T> a, BasicMatrixView<T> row, BasicMatrix &out) {
+        const T *v = vectorData(row, a.getCols());
+        out.resize(a.getRows(), a.getCols());
+        threads::parallelForRows(a.getRows(), a.getCols(), [&](int i) {
+            simd::kernels<T>().mul(a.row(i), v, &out.data[i * out.cols], out.cols);
+        });
+    }
+
+    template <typename T>
+    void BasicMatrix<T>::addColVector(BasicMatrixView<T> a, BasicMatrixView<T> col, BasicMatrix &out) {
+        const T *v = vectorData(col, a.getRows());
+        out.resize(a.getRows(), a.getCols());
+        threads::parallelForRows(a.getRows(), a.getCols(), [&](int i) {
+            simd::kernels<T>().addScalar(a.row(i), v[i], &out.data[i * out.cols], out.cols);
+        });
+    }
+
+    template <typename T>
+    void BasicMatrix<T>::mulColVector(BasicMatrixView<T> a, BasicMatrixView<T> col, BasicMatrix &out) {
+        const T *v = vectorData(col, a.getRows());
+        out.resize(a.getRows(), a.getCols());
+        threads::parallelForRows(a.getRows(), a.getCols(), [&](int i) {
+            simd::kernels<T>().mulScalar(a.row(i), v[i], &out.data[i * out.cols], out.cols);
+        });
+    }
+
+    template <typename T>
+    void BasicMatrix<T>::sumInto(BasicMatrixView<T> a, int axis, BasicMatrix &out) {
+        if (axis != 0 && axis != 1) {
+            throw std::invalid_argument("Invalid axis for sum");
         }
-        return s;
+        int n = axis == 0 ? a.getCols() : a.getRows();
+        if (overlaps(a, out)) { // reducing into the matrix being read
+            BasicMatrix result;
+            sumInto(a, axis, result);
+            out = std::move(result);
+            return;
+        }
+        if (out.getSize() != static_cast<size_t>(n) || (out.rows != 1 && out.cols != 1)) {
+            axis == 0 ? out.resize(1, n) : out.resize(n, 1);
+        }
+        if (axis == 0) { // Sum along columns, split over blocks of columns
+            std::fill(out.data.begin(), out.data.end(), 0);
+            size_t colsPerChunk = std::max<size_t>(64, threads::grain / std::max(a.getRows(), 1));
+            threads::parallelFor(n, colsPerChunk, [&](size_t begin, size_t end) {
+                for (int i = 0; i < a.getRows(); i++) {
+                    simd::kernels<T>().add(&out.data[begin], a.row(i) + begin, &out.data[begin], end - begin);
+                }
+            });
+        } else { // Sum along rows
+            threads::parallelForRows(a.getRows(), a.getCols(), [&](int i) {
+                out.data[i] = simd::kernels<T>().sum(a.row(i), a.getCols());
+            });
+        }
+    }
+
+    template <typename T>
+    void BasicMatrix<T>::sumInto(int axis, BasicMatrix &out) const {
+        sumInto(*this, axis, out);
+    }
+
+    template <typename T>
+    BasicMatrix<T> &BasicMatrix<T>::hadamardInPlace(const BasicMatrix &m) {
+        hadamard(*this, m, *this);
+        return *this;
     }
 
-    Matrix Matrix::Matrix::sum(int axis) const {
-        if (axis == 0) { // Sum along columns
-            Matrix result(1, cols);
+    template <typename T>
+    BasicMatrix<T> BasicMatrix<T>::transpose() const {
+        BasicMatrix result(cols, rows);
+        for (size_t i = 0; i < rows; i++) {
             for (size_t j = 0; j < cols; j++) {
-                for (size_t i = 0; i < rows; i++) {
-                    result(0, j) += data[i * cols + j];
-                }
-            }
-            return result;
-        } else if (axis == 1) { // Sum along rows
-            Matrix result(rows, 1);
-            for (size_t i = 0; i < rows; i++) {
-                for (size_t j = 0; j < cols; j++) {
-                    result(i, 0) += data[i * cols + j];
-                }
+                result(j, i) = data[i * cols + j];
             }
-            return result;
-        } else {
-            throw std::invalid_argument("Invalid axis for sum");
         }
+        return result;
     }
 
-    double Matrix::max() const {
-        double m = data[0];
-        for (size_t i = 1; i < rows * cols; i++) {
-            if (data[i] > m) {
-                m = data[i];
-            }
+    template <typename T>
+    BasicMatrix<T> BasicMatrix<T>::normalize() const {
+        T s = sum();
+        if (s == 0) {
+            throw std::invalid_argument("Normalization of zero vector");
         }
-        return m;
+        BasicMatrix result(rows, cols);
+        parallelKernel(simd::kernels<T>().divScalar, data.data(), s, result.data.data(), data.size());
+        return result;
+    }
+
+    template <typename T>
+    BasicMatrix<T> BasicMatrix<T>::sum(int axis) const {
+        BasicMatrix result;
+        sumInto(axis, result);
+        return result;
     }
 
-    Matrix Matrix::max(int axis) const {
+    template <typename T>
+    BasicMatrix<T> BasicMatrix<T>::max(int axis) const {
         if (axis == 0) { // Max along columns
-            Matrix result(1, cols);
+            BasicMatrix result(1, cols);
             for (size_t j = 0; j < cols; j++) {
-                double m = data[j];
+                T m = data[j];
                 for (size_t i = 1; i < rows; i++) {
                     if (data[i * cols + j] > m) {
                         m = data[i * cols + j];
@@ -374,15 +455,9 @@ namespace litenet {
             }
             return result;
         } else if (axis == 1) { // Max along rows
-            Matrix result(rows, 1);
+            BasicMatrix result(rows, 1);
             for (size_t i = 0; i < rows; i++) {
-                double m = data[i * cols];
-                for (size_t j = 1; j < cols; j++) {
-                    if (data[i * cols + j] > m) {
-                        m = data[i * cols + j];
-                    }
-                }
-                result(i, 0) = m;
+                result(i, 0) = simd::kernels<T>().max(&data[i * cols], cols);
             }
             return result;
         } else {
@@ -390,21 +465,12 @@ namespace litenet {
         }
     }
 
-    double Matrix::min() const {
-        double m = data[0];
-        for (size_t i = 1; i < rows * cols; i++) {
-            if (data[i] < m) {
-                m = data[i];
-            }
-        }
-        return m;
-    }
-
-    Matrix Matrix::min(int axis) const {
+    template <typename T>
+    BasicMatrix<T> BasicMatrix<T>::min(int axis) const {
         if (axis == 0) { // Min along columns
-            Matrix result(1, cols);
+            BasicMatrix result(1, cols);
             for (size_t j = 0; j < cols; j++) {
-                double m = data[j];
+                T m = data[j];
                 for (size_t i = 1; i < rows; i++) {
                     if (data[i * cols + j] < m) {
                         m = data[i * cols + j];
@@ -414,15 +480,9 @@ namespace litenet {
             }
             return result;
         } else if (axis == 1) { // Min along rows
-            Matrix result(rows, 1);
+            BasicMatrix result(rows, 1);
             for (size_t i = 0; i < rows; i++) {
-                double m = data[i * cols];
-                for (size_t j = 1; j < cols; j++) {
-                    if (data[i * cols + j] < m) {
-                        m = data[i * cols + j];
-                    }
-                }
-                result(i, 0) = m;
+                result(i, 0) = simd::kernels<T>().min(&data[i * cols], cols);
             }
             return result;
         } else {
@@ -430,52 +490,64 @@ namespace litenet {
         }
     }
 
-    std::vector<double> Matrix::Matrix::flatten() const {
-        return data;
+    template <typename T>
+    std::vector<T> BasicMatrix<T>::flatten() const {
+        return std::vector<T>(data.begin(), data.end());
     }
 
-    Matrix Matrix::reshape(const std::vector<double> &v, int rows, int cols) {
+    template <typename T>
+    BasicMatrix<T> BasicMatrix<T>::reshape(const std::vector<T> &v, int rows, int cols) {
         if (v.size() != rows * cols) {
             throw std::invalid_argument("Invalid vector size for reshaping");
         }
-        Matrix result(rows, cols);
-        result.data = v;
+        BasicMatrix result(rows, cols);
+        result.data.assign(v.begin(), v.end());
         return result;
     }
 
-    void Matrix::fill(double value) {
-        for (size_t i = 0; i < rows * cols; i++) {
-            data[i] = value;
-        }
+    template <typename T>
+    void BasicMatrix<T>::fill(T value) {
+        std::fill(data.begin(), data.end(), value);
     }
 
-    Matrix Matrix::subsetCols(int start, int end) const {
-        if (start < 0 || start >= cols || end < 0 || end >= cols || start > end) {
-            throw std::invalid_argument("Invalid column subset");
-        }
-        Matrix result(rows, end - start + 1);
-        for (size_t i = 0; i < rows; i++) {
-            for (size_t j = start; j <= end; j++) {
-                result(i, j - start) = data[i * cols + j];
-            }
-        }
-        return result;
+    template <typename T>
+    BasicMatrix<T> BasicMatrix<T>::subsetCols(int start, int end) const {
+        return BasicMatrix(viewCols(start, end));
     }
 
-    Matrix Matrix::subsetRows(int start, int end) const {
-        if (start < 0 || start >= rows || end < 0 || end >= rows || start > end) {
-            throw std::invalid_argument("Invalid row subset");
-        }
-        Matrix result(end - start + 1, cols);
-        for (size_t i = start; i <= end; i++) {
-            for (size_t j = 0; j < cols; j++) {
-                result(i - start, j) = data[i * cols + j];
+    template <typename T>
+    BasicMatrix<T> BasicMatrix<T>::subsetRows(int start, int end) const {
+        return BasicMatrix(viewRows(start, end));
+    }
+
+    template <typename T>
+    BasicMatrixView<T> BasicMatrix<T>::viewCols(int start, int end) const {
+        return BasicMatrixView<T>(*this).viewCols(start, end);
+    }
+
+    template <typename T>
+    BasicMatrixView<T> BasicMatrix<T>::viewRows(int start, int end) const {
+        return BasicMatrixView<T>(*this).viewRows(start, end);
+    }
+
+    template <typename T>
+    void BasicMatrix<T>::gatherRows(BasicMatrixView<T> a, const int *indices, int count, BasicMatrix &out) {
+        for (int i = 0; i < count; i++) {
+            if (indices[i] < 0 || indices[i] >= a.getRows()) {
+                throw std::invalid_argument("Invalid row index for gathering");
             }
         }
-        return result;
+        out.resize(count, a.getCols());
+        T *o = out.getData();
+        int cols = a.getCols();
+        threads::parallelForRows(count, cols, [&](int i) {
+            const T *row = a.row(indices[i]);
+            std::copy(row, row + cols, o + static_cast<size_t>(i) * cols);
+        });
     }
 
-    void Matrix::swapRows(int i, int j) {
+    template <typename T>
+    void BasicMatrix<T>::swapRows(int i, int j) {
         if (i < 0 || i >= rows || j < 0 || j >= rows) {
             throw std::invalid_argument("Invalid row indices for swapping");
         }
@@ -484,7 +556,8 @@ namespace litenet {
         }
     }
 
-    void Matrix::swapCols(int i, int j) {
+    template <typename T>
+    void BasicMatrix<T>::swapCols(int i, int j) {
         if (i < 0 || i >= cols || j < 0 || j >= cols) {
             throw std::invalid_argument("Invalid column indices for swapping");
         }
@@ -493,7 +566,8 @@ namespace litenet {
         }
     }
 
-    void Matrix::print() const {
+    template <typename T>
+    void BasicMatrix<T>::print() const {
         for (size_t i = 0; i < rows; i++) {
             for (size_t j = 0; j < cols; j++) {
                 std::cout << data[i * cols + j] << " ";
@@ -501,4 +575,7 @@ namespace litenet {
             std::cout << std::endl;
         }
     }
+
+    template class BasicMatrix<double>;
+    template class BasicMatrix<float>;
 }
\ No newline at end of file
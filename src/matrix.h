@@ -1,71 +1,232 @@
 #ifndef MATRIX_H
 #define MATRIX_H
 
+#include "expression.h"
+#include "memory.h"
+#include "gemm.h"
+
 #include <vector>
+#include <cstddef>
+#include <stdexcept>
 
 namespace litenet {
-    class Matrix {
+    // Non-owning, read-only window onto row-major data: rows x cols elements whose consecutive rows are
+    // stride elements apart. Row ranges of a matrix are contiguous (stride == cols), column blocks are not.
+    // Views are cheap to copy and must not outlive the matrix they look into
+    template <typename T>
+    class BasicMatrixView : public MatrixExpression<BasicMatrixView<T>> {
         public:
-            Matrix();
-            Matrix(int rows, int cols);
-            Matrix(int rows, int cols, double value);
-            Matrix(const Matrix &m);
-            ~Matrix();
-            Matrix &operator=(const Matrix &m);
-            double &operator()(int i, int j);
-            double operator()(int i, int j) const;
+            BasicMatrixView() : BasicMatrixView(nullptr, 0, 0, 0) {}
+            BasicMatrixView(const T *data, int rows, int cols) : BasicMatrixView(data, rows, cols, cols) {}
+            BasicMatrixView(const T *data, int rows, int cols, int stride) : data(data), rows(rows), cols(cols), stride(stride), contiguous(stride == cols || rows <= 1) {}
+            BasicMatrixView(const BasicMatrix<T> &m) : BasicMatrixView(m.getData(), m.getRows(), m.getCols()) {}
+            T operator()(int i, int j) const { return data[static_cast<size_t>(i) * stride + j]; }
+            T element(size_t i) const { return contiguous ? data[i] : data[i / cols * stride + i % cols]; }
+            void validate() const {}
+            int getRows() const { return rows; }
+            int getCols() const { return cols; }
+            int getStride() const { return stride; }
+            size_t getSize() const { return static_cast<size_t>(rows) * cols; }
+            const T *getData() const { return data; }
+            const T *row(int i) const { return data + static_cast<size_t>(i) * stride; }
+            bool isContiguous() const { return contiguous; }
+            // Rows or columns start..end inclusive, like BasicMatrix::subsetRows and subsetCols, without copying
+            BasicMatrixView viewRows(int start, int end) const {
+                if (start < 0 || start >= rows || end < 0 || end >= rows || start > end) {
+                    throw std::invalid_argument("Invalid row subset");
+                }
+                return BasicMatrixView(row(start), end - start + 1, cols, stride);
+            }
+            BasicMatrixView viewCols(int start, int end) const {
+                if (start < 0 || start >= cols || end < 0 || end >= cols || start > end) {
+                    throw std::invalid_argument("Invalid column subset");
+                }
+                return BasicMatrixView(data + start, rows, end - start + 1, stride);
+            }
+        private:
+            const T *data;
+            int rows;
+            int cols;
+            int stride;
+            bool contiguous;
+    };
+
+    // Dense row-major matrix over a floating-point scalar type; Matrix (double) is the default and
+    // MatrixF (float) halves memory and bandwidth and doubles the SIMD width
+    template <typename T>
+    class BasicMatrix : public MatrixExpression<BasicMatrix<T>> {
+        public:
+            BasicMatrix();
+            BasicMatrix(int rows, int cols);
+            BasicMatrix(int rows, int cols, T value);
+            BasicMatrix(const BasicMatrix &m);
+            BasicMatrix(BasicMatrix &&m) noexcept;
+            template <typename E>
+            BasicMatrix(const MatrixExpression<E> &e);
+            template <typename U>
+            explicit BasicMatrix(const BasicMatrix<U> &m); // conversion between scalar types
+            ~BasicMatrix();
+            BasicMatrix &operator=(const BasicMatrix &m);
+            BasicMatrix &operator=(BasicMatrix &&m) noexcept;
+            template <typename E>
+            BasicMatrix &operator=(const MatrixExpression<E> &e);
+            T &operator()(int i, int j);
+            T operator()(int i, int j) const;
+            T element(size_t i) const { return data[i]; }
+            void validate() const {}
             int getRows() const;
             int getCols() const;
+            size_t getSize() const;
+            T *getData();
+            const T *getData() const;
             std::vector<int> getShape() const;
-            Matrix operator+(const Matrix &m) const;
-            Matrix operator+(double scalar) const;
-            friend Matrix operator+(double scalar, const Matrix &m);
-            Matrix operator-(const Matrix &m) const;
-            Matrix operator-(double scalar) const;
-            friend Matrix operator-(double scalar, const Matrix &m);
-            Matrix operator*(const Matrix &m) const;
-            Matrix operator*(double factor) const;
-            friend Matrix operator*(double factor, const Matrix &m);
-            Matrix operator/(double factor) const;
-            Matrix operator/(const Matrix &m) const;
-            Matrix operator-() const;
-            Matrix &operator+=(const Matrix &m);
-            Matrix &operator+=(double scalar);
-            Matrix &operator-=(const Matrix &m);
-            Matrix &operator-=(double scalar);
-            Matrix &operator*=(const Matrix &m);
-            Matrix &operator*=(double factor);
-            Matrix &operator/=(double factor);
-            Matrix &operator/=(const Matrix &m);
-            bool operator==(const Matrix &m) const;
-            bool operator!=(const Matrix &m) const;
-            Matrix hadamard(const Matrix &m) const;
-            Matrix transpose() const;
-            Matrix normalize() const;
-            Matrix pow(double exponent) const;
-            Matrix sqrt() const;
-            Matrix abs() const;
-            Matrix sign() const;
-            Matrix log(double base = 2) const;
-            double sum() const;
-            Matrix sum(int axis) const;
-            double max() const;
-            Matrix max(int axis) const;
-            double min() const;
-            Matrix min(int axis) const;
-            std::vector<double> flatten() const;
-            static Matrix reshape(const std::vector<double> &v, int rows, int cols);
-            void fill(double value);
-            Matrix subsetCols(int start, int end) const;
-            Matrix subsetRows(int start, int end) const;
+            void resize(int rows, int cols);
+            // Moves the elements to storage, which must hold getSize() elements and outlive the matrix, and
+            // keeps them there: the matrix can then only be reshaped to the same size, and assigning to it
+            // copies into storage (see memory::Buffer). Used to lay out parameters in one arena
+            void bind(T *storage);
+            bool isBound() const;
+            // Element-wise +, -, /, scalar * and the lazy methods inherited from MatrixExpression build
+            // expressions (see expression.h); * between two matrices is the matrix product
+            BasicMatrix operator*(const BasicMatrix &m) const;
+            BasicMatrix &operator+=(const BasicMatrix &m);
+            BasicMatrix &operator+=(T scalar);
+            BasicMatrix &operator-=(const BasicMatrix &m);
+            BasicMatrix &operator-=(T scalar);
+            BasicMatrix &operator*=(const BasicMatrix &m);
+            BasicMatrix &operator*=(T factor);
+            BasicMatrix &operator/=(T factor);
+            BasicMatrix &operator/=(const BasicMatrix &m);
+            template <typename E>
+            BasicMatrix &operator+=(const MatrixExpression<E> &e);
+            template <typename E>
+            BasicMatrix &operator-=(const MatrixExpression<E> &e);
+            template <typename E>
+            BasicMatrix &operator/=(const MatrixExpression<E> &e);
+            bool operator==(const BasicMatrix &m) const;
+            bool operator!=(const BasicMatrix &m) const;
+            using MatrixExpression<BasicMatrix>::hadamard;
+            BasicMatrix transposeMultiply(const BasicMatrix &m) const;
+            BasicMatrix multiplyTranspose(const BasicMatrix &m) const;
+            // Inputs of the kernels below are views, so matrices and zero-copy slices are accepted alike
+            // epilogue, if given, runs on each finished block of c (see gemm.h)
+            static void gemm(BasicMatrixView<T> a, bool transA, BasicMatrixView<T> b, bool transB, BasicMatrix &c, T alpha = 1, T beta = 0, const litenet::gemm::Epilogue<T> *epilogue = nullptr);
+            // Out-parameter and in-place variants: out is resized only when its shape differs,
+            // so reusing the same output across calls does not allocate
+            static void add(BasicMatrixView<T> a, BasicMatrixView<T> b, BasicMatrix &out);
+            static void subtract(BasicMatrixView<T> a, BasicMatrixView<T> b, BasicMatrix &out);
+            static void hadamard(BasicMatrixView<T> a, BasicMatrixView<T> b, BasicMatrix &out);
+            static void scale(BasicMatrixView<T> a, T factor, BasicMatrix &out);
+            void mulInto(BasicMatrixView<T> m, BasicMatrix &out) const;
+            // Broadcasting: a row vector (1 x cols or cols x 1) is applied to every row of a,
+            // a column vector (rows x 1 or 1 x rows) to every column; out may be a itself
+            static void addRowVector(BasicMatrixView<T> a, BasicMatrixView<T> row, BasicMatrix &out);
+            static void mulRowVector(BasicMatrixView<T> a, BasicMatrixView<T> row, BasicMatrix &out);
+            static void addColVector(BasicMatrixView<T> a, BasicMatrixView<T> col, BasicMatrix &out);
+            static void mulColVector(BasicMatrixView<T> a, BasicMatrixView<T> col, BasicMatrix &out);
+            // Sum along an axis; out keeps its shape if it already holds the right number of elements
+            // (as a row or a column), otherwise it becomes a 1 x cols row (axis 0) or a rows x 1 column (axis 1)
+            static void sumInto(BasicMatrixView<T> a, int axis, BasicMatrix &out);
+            // out = rows indices[0..count) of a, in that order
+            static void gatherRows(BasicMatrixView<T> a, const int *indices, int count, BasicMatrix &out);
+            void sumInto(int axis, BasicMatrix &out) const;
+            BasicMatrix &hadamardInPlace(const BasicMatrix &m);
+            template <typename F>
+            BasicMatrix &applyInPlace(F f) {
+                for (T &x : data) {
+                    x = f(x);
+                }
+                return *this;
+            }
+            BasicMatrix transpose() const;
+            BasicMatrix normalize() const;
+            using MatrixExpression<BasicMatrix>::sum;
+            using MatrixExpression<BasicMatrix>::max;
+            using MatrixExpression<BasicMatrix>::min;
+            BasicMatrix sum(int axis) const;
+            BasicMatrix max(int axis) const;
+            BasicMatrix min(int axis) const;
+            std::vector<T> flatten() const;
+            static BasicMatrix reshape(const std::vector<T> &v, int rows, int cols);
+            void fill(T value);
+            BasicMatrix subsetCols(int start, int end) const;
+            BasicMatrix subsetRows(int start, int end) const;
+            BasicMatrixView<T> viewCols(int start, int end) const;
+            BasicMatrixView<T> viewRows(int start, int end) const;
             void swapRows(int i, int j);
             void swapCols(int i, int j);
             void print() const;
         private:
             int rows;
             int cols;
-            std::vector<double> data;
+            memory::Buffer<T> data; // 64-byte aligned, recycled through the pool
     };
+
+    template <typename T>
+    template <typename E>
+    BasicMatrix<T>::BasicMatrix(const MatrixExpression<E> &e) : BasicMatrix() {
+        *this = e;
+    }
+
+    template <typename T>
+    template <typename U>
+    BasicMatrix<T>::BasicMatrix(const BasicMatrix<U> &m) : rows(m.getRows()), cols(m.getCols()), data(m.getData(), m.getData() + m.getSize()) {}
+
+    template <typename T>
+    template <typename E>
+    BasicMatrix<T> &BasicMatrix<T>::operator=(const MatrixExpression<E> &e) {
+        static_assert(std::is_same_v<expression::Scalar<E>, T>, "Use the explicit conversion constructor to change the scalar type");
+        const E &expression = e.self();
+        expression.validate();
+        int resultRows = expression.getRows();
+        int resultCols = expression.getCols();
+        resize(resultRows, resultCols); // element-wise expressions may safely read this matrix while it is written
+        expression::evaluate(data.data(), expression, data.size());
+        return *this;
+    }
+
+    template <typename T>
+    template <typename E>
+    BasicMatrix<T> &BasicMatrix<T>::operator+=(const MatrixExpression<E> &e) {
+        return *this = *this + e;
+    }
+
+    template <typename T>
+    template <typename E>
+    BasicMatrix<T> &BasicMatrix<T>::operator-=(const MatrixExpression<E> &e) {
+        return *this = *this - e;
+    }
+
+    template <typename T>
+    template <typename E>
+    BasicMatrix<T> &BasicMatrix<T>::operator/=(const MatrixExpression<E> &e) {
+        return *this = *this / e;
+    }
+
+    template <typename L, typename R>
+    BasicMatrix<expression::Scalar<L>> operator*(const MatrixExpression<L> &l, const MatrixExpression<R> &r) { // Matrix multiplication of evaluated expressions
+        using Evaluated = BasicMatrix<expression::Scalar<L>>;
+        return Evaluated(l) * Evaluated(r);
+    }
+
+    template <typename L, typename R>
+    bool operator==(const MatrixExpression<L> &l, const MatrixExpression<R> &r) { // Comparison of evaluated expressions
+        using Evaluated = BasicMatrix<expression::Scalar<L>>;
+        return Evaluated(l) == Evaluated(r);
+    }
+
+    template <typename L, typename R>
+    bool operator!=(const MatrixExpression<L> &l, const MatrixExpression<R> &r) {
+        return !(l == r);
+    }
+
+    using Matrix = BasicMatrix<double>;
+    using MatrixF = BasicMatrix<float>;
+    using MatrixView = BasicMatrixView<double>;
+    using MatrixViewF = BasicMatrixView<float>;
+
+    extern template class BasicMatrix<double>;
+    extern template class BasicMatrix<float>;
 }
 
 #endif
\ No newline at end of file
@@ -0,0 +1,137 @@
+#include "memory.h"
+
+#include <new>
+#include <atomic>
+
+namespace litenet::memory {
+    namespace {
+        // Size classes are the powers of two from 64 bytes to 16 MiB
+        constexpr int minShift = 6;
+        constexpr int maxShift = 24;
+        constexpr int numClasses = maxShift - minShift + 1;
+        constexpr size_t maxCachedBytes = size_t(256) << 20; // per thread
+
+        // Index of the smallest class that holds bytes, or -1 when bytes exceeds the largest class
+        int sizeClass(size_t bytes) {
+            if (bytes > (size_t(1) << maxShift)) {
+                return -1;
+            }
+            int shift = minShift;
+            while ((size_t(1) << shift) < bytes) {
+                shift++;
+            }
+            return shift - minShift;
+        }
+
+        size_t blockSize(size_t bytes, int sizeClass) {
+            return sizeClass < 0 ? bytes : size_t(1) << (sizeClass + minShift);
+        }
+
+        // A free block stores the link to the next free block of its class in its first bytes
+        struct Block {
+            Block *next;
+        };
+
+        struct FreeLists {
+            Block *heads[numClasses] = {};
+            size_t cachedBytes = 0;
+            ~FreeLists();
+        };
+
+        thread_local FreeLists freeLists;
+        thread_local bool freeListsAlive = true; // blocks released while the thread is torn down go straight to the heap
+
+        std::atomic<size_t> allocations{0};
+        std::atomic<size_t> poolHits{0};
+        std::atomic<size_t> systemAllocations{0};
+        std::atomic<size_t> bytesInUse{0};
+        std::atomic<size_t> bytesCached{0};
+
+        void release(Block *&head) {
+            while (head) {
+                Block *next = head->next;
+                ::operator delete(head, std::align_val_t(alignment));
+                head = next;
+            }
+        }
+
+        void releaseAll(FreeLists &lists) {
+            for (Block *&head : lists.heads) {
+                release(head);
+            }
+            bytesCached.fetch_sub(lists.cachedBytes, std::memory_order_relaxed);
+            lists.cachedBytes = 0;
+        }
+
+        FreeLists::~FreeLists() {
+            releaseAll(*this);
+            freeListsAlive = false;
+        }
+    }
+
+    void *allocate(size_t bytes) {
+        allocations.fetch_add(1, std::memory_order_relaxed);
+        int c = sizeClass(bytes);
+        size_t size = blockSize(bytes, c);
+        void *p = nullptr;
+        if (c >= 0 && freeListsAlive) {
+            FreeLists &lists = freeLists;
+            if (Block *block = lists.heads[c]) {
+                lists.heads[c] = block->next;
+                lists.cachedBytes -= size;
+                bytesCached.fetch_sub(size, std::memory_order_relaxed);
+                poolHits.fetch_add(1, std::memory_order_relaxed);
+                p = block;
+            }
+        }
+        if (!p) {
+            p = ::operator new(size, std::align_val_t(alignment));
+            systemAllocations.fetch_add(1, std::memory_order_relaxed);
+        }
+        bytesInUse.fetch_add(size, std::memory_order_relaxed);
+        return p;
+    }
+
+    void deallocate(void *p, size_t bytes) noexcept {
+        if (!p) {
+            return;
+        }
+        int c = sizeClass(bytes);
+        size_t size = blockSize(bytes, c);
+        bytesInUse.fetch_sub(size, std::memory_order_relaxed);
+        if (c >= 0 && freeListsAlive) {
+            FreeLists &lists = freeLists;
+            if (lists.cachedBytes + size <= maxCachedBytes) {
+                Block *block = static_cast<Block *>(p);
+                block->next = lists.heads[c];
+                lists.heads[c] = block;
+                lists.cachedBytes += size;
+                bytesCached.fetch_add(size, std::memory_order_relaxed);
+                return;
+            }
+        }
+        ::operator delete(p, std::align_val_t(alignment));
+    }
+
+    void trim() {
+        if (freeListsAlive) {
+            releaseAll(freeLists);
+        }
+    }
+
+    Stats stats() {
+        return {
+            allocations.load(std::memory_order_relaxed),
+            poolHits.load(std::memory_order_relaxed),
+            systemAllocations.load(std::memory_order_relaxed),
+            bytesInUse.load(std::memory_order_relaxed),
+            bytesCached.load(std::memory_order_relaxed)
+        };
+    }
+
+    void resetStats() {
+        allocations.store(0, std::memory_order_relaxed);
+        poolHits.store(0, std::memory_order_relaxed);
+        systemAllocations.store(0, std::memory_order_relaxed);
+    }
+}
\ No newline at end of file
@@ -0,0 +1,163 @@
+#ifndef MEMORY_H
+#define MEMORY_H
+
+#include <cstddef>
+#include <algorithm>
+#include <iterator>
+#include <stdexcept>
+#include <type_traits>
+
+// Pooled, 64-byte aligned storage for matrices and scratch buffers
+//
+// Blocks are rounded up to a power-of-two size class and returned to a per-thread free list when
+// released, so the temporaries of a training step, which come back with the same shapes every batch,
+// are recycled without touching the global heap or taking its lock. Requests above the largest class
+// go straight to the heap. A per-thread cap bounds how much freed memory stays cached.
+namespace litenet::memory {
+    constexpr size_t alignment = 64; // one cache line, and the width of an AVX-512 register
+
+    void *allocate(size_t bytes);
+    void deallocate(void *p, size_t bytes) noexcept;
+
+    // Returns the blocks cached by the calling thread to the heap
+    void trim();
+
+    // Process-wide counters, updated with relaxed atomics
+    struct Stats {
+        size_t allocations; // calls to allocate
+        size_t poolHits; // allocations served from a free list
+        size_t systemAllocations; // allocations that went to the heap
+        size_t bytesInUse; // bytes handed out and not yet released (rounded to size classes)
+        size_t bytesCached; // bytes held in free lists
+    };
+    Stats stats();
+    void resetStats(); // zeroes the event counters; the byte gauges are kept
+
+    // Standard allocator over the pool, used as the allocator of Matrix storage
+    template <typename T>
+    struct PoolAllocator {
+        using value_type = T;
+        PoolAllocator() noexcept {}
+        template <typename U>
+        PoolAllocator(const PoolAllocator<U> &) noexcept {}
+        T *allocate(size_t n) { return static_cast<T *>(memory::allocate(n * sizeof(T))); }
+        void deallocate(T *p, size_t n) noexcept { memory::deallocate(p, n * sizeof(T)); }
+        template <typename U>
+        bool operator==(const PoolAllocator<U> &) const noexcept { return true; }
+        template <typename U>
+        bool operator!=(const PoolAllocator<U> &) const noexcept { return false; }
+    };
+
+    // Array over the pool, the storage of Matrix: like a std::vector of T with PoolAllocator, new elements are
+    // zeroed and shrinking keeps the allocation. It can instead be bound to external memory, such as a slice
+    // of a parameter arena: it then reads and writes there and keeps its size, so resizing to another size
+    // throws and assigning to it copies into the external memory (moving another size into it terminates,
+    // as move assignment is noexcept). Copies of a bound buffer own their storage; moving one moves the binding
+    template <typename T>
+    class Buffer {
+        public:
+            Buffer() noexcept {}
+            explicit Buffer(size_t n) { resize(n); }
+            Buffer(size_t n, T value) {
+                resize(n);
+                std::fill(pointer, pointer + n, value);
+            }
+            template <typename It, typename = std::enable_if_t<!std::is_integral_v<It>>>
+            Buffer(It first, It last) { assign(first, last); }
+            Buffer(const Buffer &b) { assign(b.begin(), b.end()); }
+            Buffer(Buffer &&b) noexcept : pointer(b.pointer), count(b.count), capacity(b.capacity), bound(b.bound) {
+                b.pointer = nullptr;
+                b.count = 0;
+                b.capacity = 0;
+                b.bound = false;
+            }
+            ~Buffer() { release(); }
+            Buffer &operator=(const Buffer &b) {
+                if (this != &b) {
+                    assign(b.begin(), b.end());
+                }
+                return *this;
+            }
+            Buffer &operator=(Buffer &&b) noexcept {
+                if (this == &b) {
+                    return *this;
+                }
+                if (bound) {
+                    assign(b.begin(), b.end());
+                    return *this;
+                }
+                release();
+                std::swap(pointer, b.pointer);
+                std::swap(count, b.count);
+                std::swap(capacity, b.capacity);
+                std::swap(bound, b.bound);
+                return *this;
+            }
+            T *data() noexcept { return pointer; }
+            const T *data() const noexcept { return pointer; }
+            size_t size() const noexcept { return count; }
+            T *begin() noexcept { return pointer; }
+            T *end() noexcept { return pointer + count; }
+            const T *begin() const noexcept { return pointer; }
+            const T *end() const noexcept { return pointer + count; }
+            T &operator[](size_t i) { return pointer[i]; }
+            const T &operator[](size_t i) const { return pointer[i]; }
+            void resize(size_t n) {
+                if (bound && n != count) {
+                    throw std::runtime_error("Cannot resize storage bound to external memory");
+                }
+                if (n > capacity) {
+                    T *grown = static_cast<T *>(memory::allocate(n * sizeof(T)));
+                    std::copy(pointer, pointer + count, grown);
+                    release();
+                    pointer = grown;
+                    capacity = n;
+                }
+                if (n > count) {
+                    std::fill(pointer + count, pointer + n, T());
+                }
+                count = n;
+            }
+            template <typename It>
+            void assign(It first, It last) {
+                size_t n = static_cast<size_t>(std::distance(first, last));
+                if (bound) {
+                    if (n != count) {
+                        throw std::runtime_error("Cannot resize storage bound to external memory");
+                    }
+                } else if (n > capacity) {
+                    release();
+                    pointer = static_cast<T *>(memory::allocate(n * sizeof(T)));
+                    capacity = n;
+                }
+                std::copy(first, last, pointer);
+                count = n;
+            }
+            // Moves the contents to external, which must hold size() elements and outlive the binding
+            void bind(T *external) {
+                std::copy(pointer, pointer + count, external);
+                size_t n = count;
+                release();
+                pointer = external;
+                count = n;
+                bound = true;
+            }
+            bool isBound() const noexcept { return bound; }
+        private:
+            void release() noexcept {
+                if (pointer && !bound) {
+                    memory::deallocate(pointer, capacity * sizeof(T));
+                }
+                pointer = nullptr;
+                count = 0;
+                capacity = 0;
+                bound = false;
+            }
+            T *pointer = nullptr;
+            size_t count = 0;
+            size_t capacity = 0; // 0 when bound
+            bool bound = false;
+    };
+}
+
+#endif
\ No newline at end of file
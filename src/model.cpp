@@ -1,38 +1,259 @@
 #include "model.h"
 #include "layers.h"
+#include "activations.h"
 #include "loss.h"
 #include "optimizers.h"
+#include "threads.h"
 
 #include <iostream>
 #include <random>
 #include <memory>
 #include <numeric>
 #include <algorithm>
+#include <array>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
 
 namespace litenet {
-    Model::Model() : loss("mean_squared_error") {}
+    namespace {
+        // Assembles the batches of one epoch on a background thread, at most two ahead of training: batch
+        // k + 1 is gathered (and augmented) into one buffer while batch k trains from the other. The thread
+        // waits while both buffers are full, and training waits while the next one is not
+        template <typename T>
+        class BatchPrefetcher {
+            public:
+                using Buffers = std::array<std::pair<BasicMatrix<T>, BasicMatrix<T>>, 2>;
+                BatchPrefetcher(BasicMatrixView<T> inputs, BasicMatrixView<T> targets, const std::vector<int> &indices, int batchSize, const typename BasicModel<T>::Augmentation &augment, Buffers &buffers)
+                    : inputs(inputs), targets(targets), indices(indices), batchSize(batchSize), augment(augment), buffers(buffers), producer(&BatchPrefetcher::produce, this) {}
+                ~BatchPrefetcher() {
+                    {
+                        std::lock_guard<std::mutex> lock(mutex);
+                        stopping = true;
+                    }
+                    changed.notify_all();
+                    producer.join();
+                }
+                // Waits for batch k, which stays valid until release(k)
+                std::pair<BasicMatrix<T>, BasicMatrix<T>> &acquire(int k) {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    changed.wait(lock, [&] { return full[k % 2] || error; });
+                    if (!full[k % 2]) {
+                        std::rethrow_exception(error);
+                    }
+                    return buffers[k % 2];
+                }
+                void release(int k) {
+                    {
+                        std::lock_guard<std::mutex> lock(mutex);
+                        full[k % 2] = false;
+                    }
+                    changed.notify_all();
+                }
+            private:
+                void produce() {
+                    threads::setThreadSerial(true); // the pool belongs to training
+                    int numSamples = static_cast<int>(indices.size());
+                    for (int k = 0, start = 0; start < numSamples; k++, start += batchSize) {
+                        {
+                            std::unique_lock<std::mutex> lock(mutex);
+                            changed.wait(lock, [&] { return !full[k % 2] || stopping; });
+                            if (stopping) {
+                                return;
+                            }
+                        }
+                        try {
+                            auto &[batchInputs, batchTargets] = buffers[k % 2];
+                            int count = std::min(batchSize, numSamples - start);
+                            BasicMatrix<T>::gatherRows(inputs, indices.data() + start, count, batchInputs);
+                            BasicMatrix<T>::gatherRows(targets, indices.data() + start, count, batchTargets);
+                            if (augment) {
+                                augment(batchInputs, batchTargets);
+                            }
+                        } catch (...) {
+                            std::lock_guard<std::mutex> lock(mutex);
+                            error = std::current_exception();
+                            changed.notify_all();
+                            return;
+                        }
+                        {
+                            std::lock_guard<std::mutex> lock(mutex);
+                            full[k % 2] = true;
+                        }
+                        changed.notify_all();
+                    }
+                }
+                BasicMatrixView<T> inputs;
+                BasicMatrixView<T> targets;
+                const std::vector<int> &indices;
+                int batchSize;
+                const typename BasicModel<T>::Augmentation &augment;
+                Buffers &buffers;
+                std::mutex mutex;
+                std::condition_variable changed;
+                bool full[2] = {false, false};
+                bool stopping = false;
+                std::exception_ptr error;
+                std::thread producer; // last, so that it starts once everything above is initialized
+        };
+
+        // Adds the rows of addend to sum, merging rows present in both. slots maps each row of the parameter
+        // to its position in sum, or -1, and is left all -1; merged receives the sum and is swapped with
+        // sum.values, so both buffers keep their allocations from one step to the next
+        template <typename T>
+        void addSparseRows(layers::SparseRows<T> &sum, const layers::SparseRows<T> &addend, std::vector<int> &slots, BasicMatrix<T> &merged) {
+            if (addend.rows.empty()) {
+                return;
+            }
+            int cols = addend.values.getCols();
+            size_t previous = sum.rows.size();
+            for (size_t i = 0; i < previous; i++) {
+                slots[sum.rows[i]] = static_cast<int>(i);
+            }
+            for (int row : addend.rows) {
+                if (slots[row] < 0) {
+                    slots[row] = static_cast<int>(sum.rows.size());
+                    sum.rows.push_back(row);
+                }
+            }
+            merged.resize(static_cast<int>(sum.rows.size()), cols);
+            std::copy(sum.values.getData(), sum.values.getData() + previous * cols, merged.getData());
+            std::fill(merged.getData() + previous * cols, merged.getData() + sum.rows.size() * cols, T(0));
+            for (size_t i = 0; i < addend.rows.size(); i++) {
+                const T *from = addend.values.getData() + i * cols;
+                T *to = merged.getData() + static_cast<size_t>(slots[addend.rows[i]]) * cols;
+                for (int j = 0; j < cols; j++) {
+                    to[j] += from[j];
+                }
+            }
+            for (int row : sum.rows) {
+                slots[row] = -1;
+            }
+            std::swap(sum.values, merged);
+        }
+    }
+
+    template <typename T>
+    BasicModel<T>::BasicModel(uint64_t seed) : loss("mean_squared_error"), shuffler(seed != 0 ? seed : (uint64_t(std::random_device()()) << 32) | std::random_device()()) {}
+
+    template <typename T>
+    void BasicModel<T>::setAugmentation(Augmentation augment) {
+        augmentation = std::move(augment);
+    }
+
+    template <typename T>
+    void BasicModel<T>::setDataParallel(int workers) {
+        if (workers < 1) {
+            throw std::invalid_argument("Data parallelism needs at least one worker");
+        }
+        this->workers = workers;
+    }
 
-    void Model::add(std::unique_ptr<layers::Layer> layer) {
+    template <typename T>
+    void BasicModel<T>::add(std::unique_ptr<layers::BasicLayer<T>> layer) {
         layers.push_back(std::move(layer));
     }
 
-    void Model::compile(const std::string &loss, std::unique_ptr<optimizers::Optimizer> optimizer) {
+    template <typename T>
+    void BasicModel<T>::compile(const std::string &loss, std::unique_ptr<optimizers::BasicOptimizer<T>> optimizer) {
+        if (layers.empty()) {
+            throw std::runtime_error("Model is empty");
+        }
         this->loss = loss;
         this->optimizer = std::move(optimizer);
+
+        // Build the model and lay out its parameters, gradients and optimizer state in one arena
+        for (const auto &layer : layers) {
+            layer->build();
+        }
+        arena.layOut(layers, this->optimizer->getStateCount());
     }
 
-    void Model::fit(const Matrix &inputs, const Matrix &targets, int epochs, int batchSize, const Matrix &validationInputs, const Matrix &validationTargets) {
+    template <typename T>
+    void BasicModel<T>::setTraining(bool training) {
+        for (const auto &layer : layers) {
+            layer->setTraining(training);
+        }
+        if (training) {
+            return;
+        }
+        // Fold each per-feature BatchNormalization into the linear Dense layer right before it
+        BasicMatrix<T> scale;
+        BasicMatrix<T> shift;
+        for (size_t i = 0; i + 1 < layers.size(); i++) {
+            auto *dense = dynamic_cast<layers::BasicDense<T> *>(layers[i].get());
+            auto *normalization = dynamic_cast<layers::BasicBatchNormalization<T> *>(layers[i + 1].get());
+            if (dense && normalization && dense->canFold() && normalization->isPerFeature()) {
+                normalization->inferenceScaleShift(scale, shift);
+                dense->fold(scale, shift, normalization->getActivation());
+                normalization->setFolded(true);
+            }
+        }
+    }
+
+    template <typename T>
+    double BasicModel<T>::trainStep(const std::vector<std::unique_ptr<layers::BasicLayer<T>>> &replica, BasicMatrixView<T> inputs, BasicMatrixView<T> targets, T weight, bool fusedSoftmax, BasicMatrix<T> &dLoss) {
+        // Forward pass
+        BasicMatrixView<T> predictions = inputs;
+        for (const auto &layer : replica) {
+            predictions = layer->forward(predictions);
+        }
+
+        // Compute loss and its derivative
+        bool sparse = loss == "sparse_categorical_crossentropy";
+        double currentLoss = 0;
+        if (fusedSoftmax) {
+            currentLoss = sparse ? litenet::loss::sparseSoftmaxCrossentropy(predictions, targets, dLoss) : litenet::loss::softmaxCrossentropy(predictions, targets, dLoss);
+        } else if (loss == "mean_squared_error") {
+            litenet::loss::meanSquaredErrorPrime(predictions, targets, dLoss);
+            currentLoss = litenet::loss::meanSquaredError(predictions, targets);
+        } else if (loss == "mean_absolute_error") {
+            litenet::loss::meanAbsoluteErrorPrime(predictions, targets, dLoss);
+            currentLoss = litenet::loss::meanAbsoluteError(predictions, targets);
+        } else if (loss == "binary_crossentropy") {
+            litenet::loss::binaryCrossentropyPrime(predictions, targets, dLoss);
+            currentLoss = litenet::loss::binaryCrossentropy(predictions, targets);
+        } else if (loss == "categorical_crossentropy") {
+            litenet::loss::categoricalCrossentropyPrime(predictions, targets, dLoss);
+            currentLoss = litenet::loss::categoricalCrossentropy(predictions, targets);
+        } else if (sparse) {
+            litenet::loss::sparseCategoricalCrossentropyPrime(predictions, targets, dLoss);
+            currentLoss = litenet::loss::sparseCategoricalCrossentropy(predictions, targets);
+        } else {
+            throw std::invalid_argument("unknown loss function");
+        }
+        if (weight != 1) {
+            dLoss *= weight;
+        }
+
+        // Backward pass
+        const BasicMatrix<T> *dOutput = &dLoss;
+        for (int j = replica.size() - 1; j >= 0; j--) {
+            dOutput = &replica[j]->backward(*dOutput);
+        }
+        return currentLoss;
+    }
+
+    template <typename T>
+    void BasicModel<T>::fit(BasicMatrixView<T> inputs, BasicMatrixView<T> targets, int epochs, int batchSize, BasicMatrixView<T> validationInputs, BasicMatrixView<T> validationTargets) {
         // Ensure parameters are valid
-        if (layers.empty()) {
-            throw std::runtime_error("Model is empty");
+        if (!optimizer) {
+            throw std::runtime_error("Model must be compiled before fit");
         }
         if (inputs.getRows() != targets.getRows()) {
             throw std::invalid_argument("inputs and targets must have the same number of samples");
         }
-
-        // Build the model
-        for (const auto &layer : layers) {
-            layer->build();
+        if (batchSize <= 0) {
+            throw std::invalid_argument("batchSize must be positive");
+        }
+        // Data-parallel shards normalized with their own batch statistics would not train like the whole batch
+        if (workers > 1) {
+            for (const auto &layer : layers) {
+                if (dynamic_cast<layers::BasicBatchNormalization<T> *>(layer.get())) {
+                    throw std::invalid_argument("Data-parallel training does not support BatchNormalization layers");
+                }
+            }
         }
 
         int numSamples = inputs.getRows();
@@ -41,88 +262,109 @@ namespace litenet {
             numBatches++;
         }
 
+        // A softmax Dense output trained with (sparse) categorical cross-entropy outputs its logits in training,
+        // and the loss applies the softmax: one stable pass gives both the loss and the exact gradient
+        bool sparse = loss == "sparse_categorical_crossentropy";
+        bool fusedSoftmax = false;
+        if (auto *output = dynamic_cast<layers::BasicDense<T> *>(layers.back().get())) {
+            fusedSoftmax = (loss == "categorical_crossentropy" || sparse) && output->getActivation() == activations::Activation::Softmax;
+            output->setLogitsOutput(fusedSoftmax);
+        }
+
+        // Buffers reused by every batch
+        typename BatchPrefetcher<T>::Buffers batches;
+        BasicMatrix<T> dLoss;
+
+        // Data parallelism: replica r of the layers trains shard r of each batch, with its own activations and
+        // gradients, and shares the parameters through the arena; the model's own layers train shard 0
+        std::vector<std::vector<std::unique_ptr<layers::BasicLayer<T>>>> replicas(workers - 1);
+        std::vector<memory::Buffer<T>> replicaGradients;
+        for (int r = 0; r < workers - 1; r++) {
+            for (const auto &layer : layers) {
+                replicas[r].push_back(layer->replicate(r + 1));
+                replicas[r].back()->setTraining(true);
+            }
+            replicaGradients.emplace_back(arena.getDenseSize());
+            arena.bindReplica(layers, replicas[r], replicaGradients.back().data());
+        }
+        for (const auto &segment : arena.getSegments()) {
+            if (segment.sparse) {
+                sparseSlots.resize(std::max<size_t>(sparseSlots.size(), segment.parameter->getRows()), -1);
+            }
+        }
+        std::vector<BasicMatrix<T>> shardGradients(workers);
+        std::vector<double> shardLosses(workers);
+        std::vector<std::exception_ptr> errors(workers);
+        std::vector<int> indices(numSamples);
+        std::iota(indices.begin(), indices.end(), 0); // Fill indices with 0, 1, ..., numSamples-1
+
         // Train the model
         for (int epoch = 0; epoch < epochs; epoch++) {
-            // Shuffle data
-            std::vector<int> indices(numSamples);
-            std::iota(indices.begin(), indices.end(), 0); // Fill indices with 0, 1, ..., numSamples-1
-            std::shuffle(indices.begin(), indices.end(), std::default_random_engine());
-
-            // Create shuffled inputs and targets
-            Matrix shuffledInputs(inputs.getRows(), inputs.getCols());
-            Matrix shuffledTargets(targets.getRows(), targets.getCols());
-            for (int i = 0; i < numSamples; i++) {
-                for (int j = 0; j < inputs.getCols(); j++) {
-                    shuffledInputs(i, j) = inputs(indices[i], j);
-                }
-                for (int j = 0; j < targets.getCols(); j++) {
-                    shuffledTargets(i, j) = targets(indices[i], j);
-                }
-            }
+            setTraining(true);
+
+            // A new permutation every epoch; the generator carries on across epochs and calls to fit
+            std::shuffle(indices.begin(), indices.end(), shuffler);
 
             double epochLoss = 0.0;
 
+            // Batches are gathered straight from the data, ahead of training; the last one may be shorter
+            BatchPrefetcher<T> prefetcher(inputs, targets, indices, batchSize, augmentation, batches);
             for (int batchIndex = 0; batchIndex < numBatches; batchIndex++) {
-                int startIdx = batchIndex * batchSize;
-                int endIdx = startIdx + batchSize;
-                if (endIdx > numSamples) { // Last batch
-                    endIdx = numSamples;
-                }
-
-                // Create batch inputs and targets
-                Matrix batchInputs(batchSize, inputs.getCols());
-                Matrix batchTargets(batchSize, targets.getCols());
-                for (int i = startIdx; i < endIdx; i++) {
-                    for (int j = 0; j < inputs.getCols(); j++) {
-                        batchInputs(i - startIdx, j) = shuffledInputs(i, j);
-                    }
-                    for (int j = 0; j < targets.getCols(); j++) {
-                        batchTargets(i - startIdx, j) = shuffledTargets(i, j);
-                    }
-                }
-
-                // Forward pass
-                Matrix predictions = batchInputs;
-                for (const auto &layer : layers) {
-                    predictions = layer->forward(predictions);
-                }
+                auto &batch = prefetcher.acquire(batchIndex);
+                BasicMatrixView<T> batchInputs = batch.first;
+                BasicMatrixView<T> batchTargets = batch.second;
 
-                // Compute loss and its derivative
-                Matrix dOutput;
-                if (loss == "mean_squared_error") {
-                    dOutput = litenet::loss::meanSquaredErrorPrime(predictions, batchTargets);
-                } else if (loss == "mean_absolute_error") {
-                    dOutput = litenet::loss::meanAbsoluteErrorPrime(predictions, batchTargets);
-                } else if (loss == "binary_crossentropy") {
-                    dOutput = litenet::loss::binaryCrossentropyPrime(predictions, batchTargets);
-                } else if (loss == "categorical_crossentropy") {
-                    dOutput = litenet::loss::categoricalCrossentropyPrime(predictions, batchTargets);
+                double currentLoss = 0;
+                int rows = batchInputs.getRows();
+                int shards = std::min(workers, rows);
+                if (shards == 1) {
+                    currentLoss = trainStep(layers, batchInputs, batchTargets, 1, fusedSoftmax, dLoss);
                 } else {
-                    throw std::invalid_argument("unknown loss function");
-                }
-
-                // Backward pass and weight updates
-                for (int j = layers.size() - 1; j >= 0; j--) {
-                    dOutput = layers[j]->backward(dOutput);
+                    // Shard s is rows [rows * s / shards, rows * (s + 1) / shards) of the batch; its loss gradient is
+                    // weighted by its share of the batch, so the summed gradients are those of the whole batch.
+                    // Work nested in a shard runs on the shard's thread
+                    threads::parallelFor(shards, 1, [&](size_t begin, size_t end) {
+                        for (size_t s = begin; s < end; s++) {
+                            int first = static_cast<int>(rows * s / shards);
+                            int last = static_cast<int>(rows * (s + 1) / shards);
+                            try {
+                                shardLosses[s] = trainStep(s == 0 ? layers : replicas[s - 1], batchInputs.viewRows(first, last - 1), batchTargets.viewRows(first, last - 1), T(last - first) / rows, fusedSoftmax, shardGradients[s]);
+                            } catch (...) {
+                                errors[s] = std::current_exception();
+                            }
+                        }
+                    });
+                    for (int s = 0; s < shards; s++) {
+                        if (errors[s]) {
+                            std::rethrow_exception(errors[s]);
+                        }
+                        currentLoss += shardLosses[s] * (rows * (s + 1) / shards - rows * s / shards) / rows;
+                    }
 
-                    // Update weights and biases
-                    optimizer->update(*layers[j]);
+                    // All-reduce: the model's gradients become the sum over the shards. Each chunk of the flat
+                    // gradient arrays is summed by one thread, replica by replica
+                    T *sum = arena.getGradients();
+                    threads::parallelFor(arena.getDenseSize(), threads::grain, [&](size_t begin, size_t end) {
+                        for (int r = 1; r < shards; r++) {
+                            const T *gradients = replicaGradients[r - 1].data();
+                            for (size_t k = begin; k < end; k++) {
+                                sum[k] += gradients[k];
+                            }
+                        }
+                    });
+                    for (const auto &segment : arena.getSegments()) {
+                        if (segment.sparse) {
+                            size_t index = std::find_if(layers.begin(), layers.end(), [&](const auto &layer) { return layer.get() == segment.layer; }) - layers.begin();
+                            for (int r = 1; r < shards; r++) {
+                                addSparseRows(segment.layer->sparseGradients[segment.name], replicas[r - 1][index]->sparseGradients[segment.name], sparseSlots, sparseMerge);
+                            }
+                        }
+                    }
                 }
+                optimizer->update(arena); // one update of every parameter in the arena
 
-                // Calculate loss for reporting
-                double currentLoss;
-                if (loss == "mean_squared_error") {
-                    currentLoss = litenet::loss::meanSquaredError(predictions, batchTargets);
-                } else if (loss == "mean_absolute_error") {
-                    currentLoss = litenet::loss::meanAbsoluteError(predictions, batchTargets);
-                } else if (loss == "binary_crossentropy") {
-                    currentLoss = litenet::loss::binaryCrossentropy(predictions, batchTargets);
-                } else if (loss == "categorical_crossentropy") {
-                    currentLoss = litenet::loss::categoricalCrossentropy(predictions, batchTargets);
-                } else {
-                    throw std::invalid_argument("unknown loss function");
-                }
                 epochLoss += currentLoss;
+                prefetcher.release(batchIndex);
                 std::cout << "Batch " << (batchIndex + 1) << "/" << numBatches << " | loss: " << epochLoss / (batchIndex + 1) << "\r";
             }
 
@@ -135,7 +377,8 @@ namespace litenet {
             }
 
             // Calculate validation loss
-            Matrix validationPredictions = validationInputs;
+            setTraining(false);
+            BasicMatrixView<T> validationPredictions = validationInputs;
             for (const auto &layer : layers) {
                 validationPredictions = layer->forward(validationPredictions);
             }
@@ -149,6 +392,8 @@ namespace litenet {
                 validationLoss = litenet::loss::binaryCrossentropy(validationPredictions, validationTargets);
             } else if (loss == "categorical_crossentropy") {
                 validationLoss = litenet::loss::categoricalCrossentropy(validationPredictions, validationTargets);
+            } else if (sparse) {
+                validationLoss = litenet::loss::sparseCategoricalCrossentropy(validationPredictions, validationTargets);
             } else {
                 throw std::invalid_argument("unknown loss function");
             }
@@ -158,22 +403,29 @@ namespace litenet {
         }
     }
 
-    Matrix Model::predict(const Matrix &inputs) {
+    template <typename T>
+    BasicMatrix<T> BasicModel<T>::predict(BasicMatrixView<T> inputs) {
         if (layers.empty()) {
             throw std::runtime_error("Model is empty");
         }
-        Matrix predictions = inputs;
+        setTraining(false);
+        BasicMatrixView<T> predictions = inputs;
         for (const auto &layer : layers) {
             predictions = layer->forward(predictions);
         }
-        return predictions;
+        return BasicMatrix<T>(predictions);
     }
 
-    std::vector<double> Model::evaluate(const Matrix &inputs, const Matrix &targets) {
+    template <typename T>
+    std::vector<double> BasicModel<T>::evaluate(BasicMatrixView<T> inputs, BasicMatrixView<T> targets) {
         if (layers.empty()) {
             throw std::runtime_error("Model is empty");
         }
-        Matrix predictions = predict(inputs);
+        setTraining(false);
+        BasicMatrixView<T> predictions = inputs; // read the last layer's output in place instead of copying it
+        for (const auto &layer : layers) {
+            predictions = layer->forward(predictions);
+        }
         std::vector<double> results;
         if (loss == "mean_squared_error") {
             results.push_back(litenet::loss::meanSquaredError(predictions, targets));
@@ -183,17 +435,20 @@ namespace litenet {
             results.push_back(litenet::loss::binaryCrossentropy(predictions, targets));
         } else if (loss == "categorical_crossentropy") {
             results.push_back(litenet::loss::categoricalCrossentropy(predictions, targets));
+        } else if (loss == "sparse_categorical_crossentropy") {
+            results.push_back(litenet::loss::sparseCategoricalCrossentropy(predictions, targets));
         } else {
             throw std::invalid_argument("unknown loss function");
         }
 
-        // Accuracy
+        // Accuracy; sparse targets are class ids, compared directly
+        bool sparse = loss == "sparse_categorical_crossentropy";
         int correct = 0;
         for (int i = 0; i < predictions.getRows(); i++) {
-            int targetIndex = -1;
-            int predictionIndex = -1;
+            int targetIndex = sparse ? static_cast<int>(targets(i, 0)) : -1;
+            int predictionIndex = 0;
             for (int j = 0; j < predictions.getCols(); j++) {
-                if (targets(i, j) == 1) {
+                if (!sparse && targets(i, j) == 1) {
                     targetIndex = j;
                 }
                 if (predictions(i, j) > predictions(i, predictionIndex)) {
@@ -208,4 +463,7 @@ namespace litenet {
 
         return results;
     }
+
+    template class BasicModel<double>;
+    template class BasicModel<float>;
 }
\ No newline at end of file
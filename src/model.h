@@ -3,24 +3,63 @@
 
 #include "layers.h"
 #include "optimizers.h"
+#include "arena.h"
+#include "random.h"
 
 #include <vector>
 #include <memory>
+#include <cstdint>
+#include <functional>
 
 namespace litenet {
-    class Model {
+    // A model trains and predicts in a single scalar type: Model uses double and ModelF float,
+    // which must be built from float layers and optimizers (e.g. layers::BasicDense<float>)
+    template <typename T>
+    class BasicModel {
         public:
-            Model();
-            void add(std::unique_ptr<layers::Layer> layer);
-            void compile(const std::string &loss, const std::unique_ptr<optimizers::Optimizer> optimizer);
-            void fit(const Matrix &inputs, const Matrix &targets, int epochs, int batchSize = 32, const Matrix &validationInputs = Matrix(), const Matrix &validationTargets = Matrix());
-            Matrix predict(const Matrix &inputs);
-            std::vector<double> evaluate(const Matrix &inputs, const Matrix &targets);
+            // fit shuffles the samples every epoch with a generator started from seed; a seed of 0 draws one
+            // from std::random_device
+            BasicModel(uint64_t seed = 0);
+            void add(std::unique_ptr<layers::BasicLayer<T>> layer);
+            // Called by fit on every training batch, in place, right after it is gathered. It runs on the thread
+            // that prepares the next batch while the current one trains, so it must not use the model
+            using Augmentation = std::function<void(BasicMatrix<T> &inputs, BasicMatrix<T> &targets)>;
+            void setAugmentation(Augmentation augment);
+            // fit trains every batch on workers shards side by side: each worker runs forward and backward on its
+            // shard with its own replica of the layers, and the shards' gradients are summed before a single
+            // optimizer step, which matches training on the whole batch up to rounding. Each replica of a
+            // Dropout draws its own masks. fit rejects more than one worker for a model with BatchNormalization,
+            // whose batch statistics would be those of a shard. 1 (the default) trains on whole batches
+            void setDataParallel(int workers);
+            // Builds the layers added so far and lays out their parameters, gradients and the optimizer's state
+            // in one arena; fit then continues from the current parameters, so calling it again trains further
+            void compile(const std::string &loss, const std::unique_ptr<optimizers::BasicOptimizer<T>> optimizer);
+            // Inputs and targets are taken as views, so training and validation splits of one dataset need no copies
+            void fit(BasicMatrixView<T> inputs, BasicMatrixView<T> targets, int epochs, int batchSize = 32, BasicMatrixView<T> validationInputs = BasicMatrixView<T>(), BasicMatrixView<T> validationTargets = BasicMatrixView<T>());
+            BasicMatrix<T> predict(BasicMatrixView<T> inputs);
+            std::vector<double> evaluate(BasicMatrixView<T> inputs, BasicMatrixView<T> targets);
         private:
-            std::vector<std::unique_ptr<layers::Layer>> layers;
+            void setTraining(bool training);
+            // Forward and backward over one batch through replica (the model's layers or a copy of them), with
+            // the loss gradient scaled by weight; leaves the gradients in the layers and returns the loss
+            double trainStep(const std::vector<std::unique_ptr<layers::BasicLayer<T>>> &replica, BasicMatrixView<T> inputs, BasicMatrixView<T> targets, T weight, bool fusedSoftmax, BasicMatrix<T> &dLoss);
+            BasicParameterArena<T> arena; // declared before the layers, whose parameters are bound to it
+            std::vector<std::unique_ptr<layers::BasicLayer<T>>> layers;
             std::string loss;
-            std::unique_ptr<optimizers::Optimizer> optimizer;
+            std::unique_ptr<optimizers::BasicOptimizer<T>> optimizer;
+            random::Xoshiro256 shuffler;
+            Augmentation augmentation;
+            int workers = 1;
+            // Data parallelism: the merge of the replicas' row-sparse gradients, reused by every step (see fit)
+            std::vector<int> sparseSlots; // per parameter row, its position in the merged gradient, or -1
+            BasicMatrix<T> sparseMerge;
     };
+
+    using Model = BasicModel<double>;
+    using ModelF = BasicModel<float>;
+
+    extern template class BasicModel<double>;
+    extern template class BasicModel<float>;
 }
 
 #endif
\ No newline at end of file
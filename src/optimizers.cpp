@@ -1,151 +1,321 @@
 #include "optimizers.h"
 #include "layers.h"
+#include "threads.h"
 
 #include <cmath>
+#include <stdexcept>
+#include <algorithm>
 
 namespace litenet::optimizers {
-    Optimizer::Optimizer(double learningRate) : learningRate(learningRate) {}
-
-    SGD::SGD(double learningRate) : Optimizer(learningRate) {}
-
-    void SGD::update(layers::Layer &layer) {
-        for (auto it = layer.parameters.begin(); it != layer.parameters.end(); it++) {
-            std::string name = it->first;
-            Matrix &parameter = it->second;
-            Matrix &dParameter = layer.gradients[name];
-            parameter -= dParameter * learningRate;
+    namespace {
+        // Calls kernel(offset, gradient, n) over blocks of the parameter's gradient: chunks of the whole
+        // tensor for a dense gradient, the touched rows for a row-sparse one (see layers::SparseRows). offset
+        // is the block's first element in the parameter and in any optimizer state of the same shape, so
+        // each optimizer writes its update once, as a single fused loop over n elements
+        template <typename T, typename K>
+        void forEachBlock(layers::BasicLayer<T> &layer, const std::string &name, const BasicMatrix<T> &parameter, const K &kernel) {
+            auto sparse = layer.sparseGradients.find(name);
+            if (sparse != layer.sparseGradients.end()) {
+                const layers::SparseRows<T> &dParameter = sparse->second;
+                int cols = parameter.getCols();
+                threads::parallelForRows(static_cast<int>(dParameter.rows.size()), cols, [&](int i) {
+                    kernel(static_cast<size_t>(dParameter.rows[i]) * cols, dParameter.values.getData() + static_cast<size_t>(i) * cols, static_cast<size_t>(cols));
+                });
+                return;
+            }
+            auto dense = layer.gradients.find(name);
+            if (dense == layer.gradients.end() || dense->second.getSize() != parameter.getSize()) {
+                throw std::runtime_error("No gradient matching parameter " + name + " of layer " + layer.getName());
+            }
+            const T *dParameter = dense->second.getData();
+            threads::parallelFor(parameter.getSize(), threads::grain, [&](size_t begin, size_t end) {
+                kernel(begin, dParameter + begin, end - begin);
+            });
         }
-    }
-
-    Adam::Adam(double learningRate, double beta1, double beta2, double epsilon) : Optimizer(learningRate), beta1(beta1), beta2(beta2), epsilon(epsilon), t(0) {}
 
-    void Adam::update(layers::Layer &layer) {
-        t++;
-
-        for (auto it = layer.parameters.begin(); it != layer.parameters.end(); it++) {
-            std::string name = it->first;
-            Matrix &parameter = it->second;
-            Matrix &dParameter = layer.gradients[name];
+        // The same over a whole arena, with offsets into its flat arrays: kernel(offset, gradient, n, segment)
+        // runs over grain-sized chunks of the dense parameters, split where a chunk crosses from one tensor
+        // to the next, then over the touched rows of each row-sparse parameter
+        template <typename T, typename K>
+        void forEachBlock(BasicParameterArena<T> &arena, const K &kernel) {
+            using Segment = typename BasicParameterArena<T>::Segment;
+            const std::vector<Segment> &segments = arena.getSegments();
+            const T *gradients = arena.getGradients();
+            threads::parallelFor(arena.getDenseSize(), threads::grain, [&](size_t begin, size_t end) {
+                size_t s = std::upper_bound(segments.begin(), segments.end(), begin, [](size_t offset, const Segment &segment) {
+                    return offset < segment.offset;
+                }) - segments.begin() - 1;
+                while (begin < end) {
+                    size_t segmentEnd = s + 1 < segments.size() ? segments[s + 1].offset : arena.getSize();
+                    size_t blockEnd = std::min(end, segmentEnd);
+                    kernel(begin, gradients + begin, blockEnd - begin, segments[s]);
+                    begin = blockEnd;
+                    s++;
+                }
+            });
+            for (const Segment &segment : segments) {
+                if (!segment.sparse) {
+                    continue;
+                }
+                const layers::SparseRows<T> &dParameter = segment.layer->sparseGradients[segment.name];
+                int cols = segment.parameter->getCols();
+                threads::parallelForRows(static_cast<int>(dParameter.rows.size()), cols, [&](int i) {
+                    kernel(segment.offset + static_cast<size_t>(dParameter.rows[i]) * cols, dParameter.values.getData() + static_cast<size_t>(i) * cols, static_cast<size_t>(cols), segment);
+                });
+            }
+        }
 
-            int rows = parameter.getRows();
-            int cols = parameter.getCols();
+        // Element kernels, shared by the per-layer and arena updates
 
-            if (m.find(name) == m.end()) {
-                m[name] = Matrix(rows, cols);
+        template <typename T>
+        void sgdKernel(T *p, const T *g, size_t n, T learningRate) {
+            for (size_t j = 0; j < n; j++) {
+                p[j] -= learningRate * g[j];
             }
+        }
 
-            if (v.find(name) == v.end()) {
-                v[name] = Matrix(rows, cols);
+        // Adam and AdamW in one pass: both moments, the bias-corrected step and the decoupled decay factor
+        // (1 for none). mHat and vHat are folded into the step size and the scale of v
+        template <typename T>
+        struct AdamStep {
+            T beta1;
+            T beta2;
+            T epsilon;
+            T step;
+            T vScale;
+            AdamStep(double learningRate, double beta1, double beta2, double epsilon, long long t) : beta1(static_cast<T>(beta1)), beta2(static_cast<T>(beta2)), epsilon(static_cast<T>(epsilon)), step(static_cast<T>(learningRate / (1 - std::pow(beta1, t)))), vScale(static_cast<T>(1 / (1 - std::pow(beta2, t)))) {}
+        };
+
+        template <typename T>
+        void adamKernel(T *p, T *m, T *v, const T *g, size_t n, const AdamStep<T> &c, T decay) {
+            for (size_t j = 0; j < n; j++) {
+                m[j] = c.beta1 * m[j] + (1 - c.beta1) * g[j];
+                v[j] = c.beta2 * v[j] + (1 - c.beta2) * g[j] * g[j];
+                p[j] = (p[j] - c.step * m[j] / (std::sqrt(v[j] * c.vScale) + c.epsilon)) * decay;
             }
+        }
 
-            if (m[name].getRows() != rows || m[name].getCols() != cols) {
-                m[name] = Matrix(rows, cols);
+        template <typename T>
+        void adaGradKernel(T *p, T *v, const T *g, size_t n, T learningRate, T epsilon) {
+            for (size_t j = 0; j < n; j++) {
+                v[j] += g[j] * g[j];
+                p[j] -= learningRate * g[j] / (std::sqrt(v[j]) + epsilon);
             }
+        }
 
-            if (v[name].getRows() != rows || v[name].getCols() != cols) {
-                v[name] = Matrix(rows, cols);
+        template <typename T>
+        void rmsPropKernel(T *p, T *v, const T *g, size_t n, T learningRate, T beta, T epsilon) {
+            for (size_t j = 0; j < n; j++) {
+                v[j] = beta * v[j] + (1 - beta) * g[j] * g[j];
+                p[j] -= learningRate * g[j] / (std::sqrt(v[j]) + epsilon);
             }
+        }
+    }
 
-            m[name] = beta1 * m[name] + (1 - beta1) * dParameter;
-            v[name] = beta2 * v[name] + (1 - beta2) * dParameter.pow(2);
+    template <typename T>
+    BasicOptimizer<T>::BasicOptimizer(double learningRate) : learningRate(learningRate) {}
 
-            Matrix mHat = m[name] / (1 - std::pow(beta1, t));
-            Matrix vHat = v[name] / (1 - std::pow(beta2, t));
+    template <typename T>
+    void BasicOptimizer<T>::update(BasicParameterArena<T> &arena) {
+        std::vector<layers::BasicLayer<T> *> updated;
+        for (const auto &segment : arena.getSegments()) {
+            if (std::find(updated.begin(), updated.end(), segment.layer) == updated.end()) {
+                updated.push_back(segment.layer);
+                update(*segment.layer);
+            }
+        }
+    }
 
-            parameter -= mHat / (vHat.sqrt() + epsilon) * learningRate;
+    template <typename T>
+    typename BasicOptimizer<T>::Slot &BasicOptimizer<T>::slot(const BasicMatrix<T> &parameter, bool firstMoment, bool secondMoment) {
+        Slot &state = slots[&parameter];
+        int rows = parameter.getRows();
+        int cols = parameter.getCols();
+        if (firstMoment && (state.m.getRows() != rows || state.m.getCols() != cols)) {
+            state.m = BasicMatrix<T>(rows, cols, T(0));
+            state.t = 0;
+        }
+        if (secondMoment && (state.v.getRows() != rows || state.v.getCols() != cols)) {
+            state.v = BasicMatrix<T>(rows, cols, T(0));
+            state.t = 0;
         }
+        return state;
     }
 
-    AdamW::AdamW(double learningRate, double weightDecay, double beta1, double beta2, double epsilon) : Optimizer(learningRate), weightDecay(weightDecay), beta1(beta1), beta2(beta2), epsilon(epsilon), t(0) {}
+    template <typename T>
+    BasicSGD<T>::BasicSGD(double learningRate) : BasicOptimizer<T>(learningRate) {}
 
-    void AdamW::update(layers::Layer &layer) {
-        t++;
+    template <typename T>
+    int BasicSGD<T>::getStateCount() const {
+        return 0;
+    }
 
+    template <typename T>
+    void BasicSGD<T>::update(layers::BasicLayer<T> &layer) {
+        T learningRate = static_cast<T>(this->learningRate);
         for (auto it = layer.parameters.begin(); it != layer.parameters.end(); it++) {
-            std::string name = it->first;
-            Matrix &parameter = it->second;
-            Matrix &dParameter = layer.gradients[name];
-
-            int rows = parameter.getRows();
-            int cols = parameter.getCols();
+            T *p = it->second.getData();
+            forEachBlock(layer, it->first, it->second, [&](size_t offset, const T *g, size_t n) {
+                sgdKernel(p + offset, g, n, learningRate);
+            });
+        }
+    }
 
-            if (m.find(name) == m.end()) {
-                m[name] = Matrix(rows, cols);
-            }
+    template <typename T>
+    void BasicSGD<T>::update(BasicParameterArena<T> &arena) {
+        T learningRate = static_cast<T>(this->learningRate);
+        T *p = arena.getParameters();
+        arena.nextStep();
+        forEachBlock(arena, [&](size_t offset, const T *g, size_t n, const typename BasicParameterArena<T>::Segment &) {
+            sgdKernel(p + offset, g, n, learningRate);
+        });
+    }
 
-            if (v.find(name) == v.end()) {
-                v[name] = Matrix(rows, cols);
-            }
+    template <typename T>
+    BasicAdam<T>::BasicAdam(double learningRate, double beta1, double beta2, double epsilon) : BasicOptimizer<T>(learningRate), beta1(beta1), beta2(beta2), epsilon(epsilon) {}
 
-            if (m[name].getRows() != rows || m[name].getCols() != cols) {
-                m[name] = Matrix(rows, cols);
-            }
+    template <typename T>
+    int BasicAdam<T>::getStateCount() const {
+        return 2;
+    }
 
-            if (v[name].getRows() != rows || v[name].getCols() != cols) {
-                v[name] = Matrix(rows, cols);
-            }
+    // Row-sparse gradients update lazily, in both Adam and AdamW: only rows with a gradient advance their
+    // moments, and the bias correction uses the step count of the whole tensor
+    template <typename T>
+    void BasicAdam<T>::update(layers::BasicLayer<T> &layer) {
+        for (auto it = layer.parameters.begin(); it != layer.parameters.end(); it++) {
+            typename BasicOptimizer<T>::Slot &state = this->slot(it->second, true, true);
+            AdamStep<T> step(this->learningRate, beta1, beta2, epsilon, ++state.t);
+            T *p = it->second.getData();
+            T *m = state.m.getData();
+            T *v = state.v.getData();
+            forEachBlock(layer, it->first, it->second, [&](size_t offset, const T *g, size_t n) {
+                adamKernel(p + offset, m + offset, v + offset, g, n, step, T(1));
+            });
+        }
+    }
 
-            m[name] = beta1 * m[name] + (1 - beta1) * dParameter;
-            v[name] = beta2 * v[name] + (1 - beta2) * dParameter.pow(2);
+    template <typename T>
+    void BasicAdam<T>::update(BasicParameterArena<T> &arena) {
+        AdamStep<T> step(this->learningRate, beta1, beta2, epsilon, arena.nextStep());
+        T *p = arena.getParameters();
+        T *m = arena.getState(0);
+        T *v = arena.getState(1);
+        forEachBlock(arena, [&](size_t offset, const T *g, size_t n, const typename BasicParameterArena<T>::Segment &) {
+            adamKernel(p + offset, m + offset, v + offset, g, n, step, T(1));
+        });
+    }
 
-            Matrix mHat = m[name] / (1 - std::pow(beta1, t));
-            Matrix vHat = v[name] / (1 - std::pow(beta2, t));
+    template <typename T>
+    BasicAdamW<T>::BasicAdamW(double learningRate, double weightDecay, double beta1, double beta2, double epsilon) : BasicOptimizer<T>(learningRate), weightDecay(weightDecay), beta1(beta1), beta2(beta2), epsilon(epsilon) {}
 
-            parameter -= mHat / (vHat.sqrt() + epsilon) * learningRate;
+    template <typename T>
+    int BasicAdamW<T>::getStateCount() const {
+        return 2;
+    }
 
-            if (weightDecay > 0 && name == "weights") {
-                parameter -= parameter * weightDecay * learningRate;
-            }
+    template <typename T>
+    void BasicAdamW<T>::update(layers::BasicLayer<T> &layer) {
+        for (auto it = layer.parameters.begin(); it != layer.parameters.end(); it++) {
+            typename BasicOptimizer<T>::Slot &state = this->slot(it->second, true, true);
+            AdamStep<T> step(this->learningRate, beta1, beta2, epsilon, ++state.t);
+            T decay = static_cast<T>(weightDecay > 0 && it->first == "weights" ? 1 - weightDecay * this->learningRate : 1);
+            T *p = it->second.getData();
+            T *m = state.m.getData();
+            T *v = state.v.getData();
+            forEachBlock(layer, it->first, it->second, [&](size_t offset, const T *g, size_t n) {
+                adamKernel(p + offset, m + offset, v + offset, g, n, step, decay);
+            });
         }
     }
 
-    AdaGrad::AdaGrad(double learningRate, double epsilon) : Optimizer(learningRate), epsilon(epsilon) {}
+    template <typename T>
+    void BasicAdamW<T>::update(BasicParameterArena<T> &arena) {
+        AdamStep<T> step(this->learningRate, beta1, beta2, epsilon, arena.nextStep());
+        T weightsDecay = static_cast<T>(weightDecay > 0 ? 1 - weightDecay * this->learningRate : 1);
+        T *p = arena.getParameters();
+        T *m = arena.getState(0);
+        T *v = arena.getState(1);
+        forEachBlock(arena, [&](size_t offset, const T *g, size_t n, const typename BasicParameterArena<T>::Segment &segment) {
+            adamKernel(p + offset, m + offset, v + offset, g, n, step, segment.name == "weights" ? weightsDecay : T(1));
+        });
+    }
 
-    void AdaGrad::update(layers::Layer &layer) {
-        for (auto it = layer.parameters.begin(); it != layer.parameters.end(); it++) {
-            std::string name = it->first;
-            Matrix &parameter = it->second;
-            Matrix &dParameter = layer.gradients[name];
-            
-            int rows = parameter.getRows();
-            int cols = parameter.getCols();
-
-            if (v.find(name) == v.end()) {
-                v[name] = Matrix(rows, cols);
-            }
+    template <typename T>
+    BasicAdaGrad<T>::BasicAdaGrad(double learningRate, double epsilon) : BasicOptimizer<T>(learningRate), epsilon(epsilon) {}
 
-            if (v[name].getRows() != rows || v[name].getCols() != cols) {
-                v[name] = Matrix(rows, cols);
-            }
-
-            v[name] += dParameter.pow(2);
+    template <typename T>
+    int BasicAdaGrad<T>::getStateCount() const {
+        return 1;
+    }
 
-            parameter -= dParameter / (v[name].sqrt() + epsilon) * learningRate;
+    template <typename T>
+    void BasicAdaGrad<T>::update(layers::BasicLayer<T> &layer) {
+        T learningRate = static_cast<T>(this->learningRate), eps = static_cast<T>(epsilon);
+        for (auto it = layer.parameters.begin(); it != layer.parameters.end(); it++) {
+            typename BasicOptimizer<T>::Slot &state = this->slot(it->second, false, true);
+            state.t++;
+            T *p = it->second.getData();
+            T *v = state.v.getData();
+            forEachBlock(layer, it->first, it->second, [&](size_t offset, const T *g, size_t n) {
+                adaGradKernel(p + offset, v + offset, g, n, learningRate, eps);
+            });
         }
     }
 
-    RMSProp::RMSProp(double learningRate, double beta, double epsilon) : Optimizer(learningRate), beta(beta), epsilon(epsilon) {}
+    template <typename T>
+    void BasicAdaGrad<T>::update(BasicParameterArena<T> &arena) {
+        T learningRate = static_cast<T>(this->learningRate), eps = static_cast<T>(epsilon);
+        T *p = arena.getParameters();
+        T *v = arena.getState(0);
+        arena.nextStep();
+        forEachBlock(arena, [&](size_t offset, const T *g, size_t n, const typename BasicParameterArena<T>::Segment &) {
+            adaGradKernel(p + offset, v + offset, g, n, learningRate, eps);
+        });
+    }
 
-    void RMSProp::update(layers::Layer &layer) {
-        for (auto it = layer.parameters.begin(); it != layer.parameters.end(); it++) {
-            std::string name = it->first;
-            Matrix &parameter = it->second;
-            Matrix &dParameter = layer.gradients[name];
-            
-            int rows = parameter.getRows();
-            int cols = parameter.getCols();
-
-            if (v.find(name) == v.end()) {
-                v[name] = Matrix(rows, cols);
-            }
+    template <typename T>
+    BasicRMSProp<T>::BasicRMSProp(double learningRate, double beta, double epsilon) : BasicOptimizer<T>(learningRate), beta(beta), epsilon(epsilon) {}
 
-            if (v[name].getRows() != rows || v[name].getCols() != cols) {
-                v[name] = Matrix(rows, cols);
-            }
-
-            v[name] = beta * v[name] + (1 - beta) * dParameter.pow(2);
+    template <typename T>
+    int BasicRMSProp<T>::getStateCount() const {
+        return 1;
+    }
 
-            parameter -= dParameter / (v[name].sqrt() + epsilon) * learningRate;
+    // Rows without a gradient in a row-sparse update keep their second moment instead of decaying it
+    template <typename T>
+    void BasicRMSProp<T>::update(layers::BasicLayer<T> &layer) {
+        T learningRate = static_cast<T>(this->learningRate), b = static_cast<T>(beta), eps = static_cast<T>(epsilon);
+        for (auto it = layer.parameters.begin(); it != layer.parameters.end(); it++) {
+            typename BasicOptimizer<T>::Slot &state = this->slot(it->second, false, true);
+            state.t++;
+            T *p = it->second.getData();
+            T *v = state.v.getData();
+            forEachBlock(layer, it->first, it->second, [&](size_t offset, const T *g, size_t n) {
+                rmsPropKernel(p + offset, v + offset, g, n, learningRate, b, eps);
+            });
         }
     }
+
+    template <typename T>
+    void BasicRMSProp<T>::update(BasicParameterArena<T> &arena) {
+        T learningRate = static_cast<T>(this->learningRate), b = static_cast<T>(beta), eps = static_cast<T>(epsilon);
+        T *p = arena.getParameters();
+        T *v = arena.getState(0);
+        arena.nextStep();
+        forEachBlock(arena, [&](size_t offset, const T *g, size_t n, const typename BasicParameterArena<T>::Segment &) {
+            rmsPropKernel(p + offset, v + offset, g, n, learningRate, b, eps);
+        });
+    }
+
+    #define LITENET_INSTANTIATE(T) \
+        template class BasicOptimizer<T>; \
+        template class BasicSGD<T>; \
+        template class BasicAdam<T>; \
+        template class BasicAdamW<T>; \
+        template class BasicAdaGrad<T>; \
+        template class BasicRMSProp<T>;
+    LITENET_INSTANTIATE(double)
+    LITENET_INSTANTIATE(float)
+    #undef LITENET_INSTANTIATE
 }
\ No newline at end of file
@@ -3,66 +3,116 @@
 
 #include "matrix.h"
 #include "layers.h"
+#include "arena.h"
 
 #include <vector>
 #include <unordered_map>
 
 namespace litenet::optimizers {
-    class Optimizer {
+    // Optimizers are templates over the scalar type of the layers they update;
+    // hyperparameters stay double. SGD, Adam, AdamW, AdaGrad and RMSProp are the double versions
+    template <typename T>
+    class BasicOptimizer {
         public:
-            Optimizer(double learningRate);
-            virtual ~Optimizer() {}
-            virtual void update(layers::Layer &layer) = 0;
+            BasicOptimizer(double learningRate);
+            virtual ~BasicOptimizer() {}
+            virtual void update(layers::BasicLayer<T> &layer) = 0;
+            // One step over every parameter laid out in arena, with the state kept there: the built-in
+            // optimizers update the dense parameters in a single parallel sweep over the flat arrays, then
+            // the touched rows of the row-sparse ones. By default, each layer is updated in turn
+            virtual void update(BasicParameterArena<T> &arena);
+            // Number of per-element state arrays the arena holds for update(arena)
+            virtual int getStateCount() const { return 0; }
         protected:
+            // State of one parameter tensor: moment estimates shaped like it (left empty when unused) and the
+            // number of updates it has received, which is the number of training steps
+            struct Slot {
+                BasicMatrix<T> m;
+                BasicMatrix<T> v;
+                long long t = 0;
+            };
+            // The slot of parameter, created zeroed on its first update. Slots are keyed by the parameter
+            // itself, so layers whose parameters share a name never share state; the parameter must keep
+            // its address (entries of a layer's parameters map do)
+            Slot &slot(const BasicMatrix<T> &parameter, bool firstMoment, bool secondMoment);
             double learningRate;
+        private:
+            std::unordered_map<const BasicMatrix<T> *, Slot> slots;
     };
-    class SGD : public Optimizer {
+    template <typename T>
+    class BasicSGD : public BasicOptimizer<T> {
         public:
-            SGD(double learningRate = 0.1);
-            void update(layers::Layer &layer) override;
+            BasicSGD(double learningRate = 0.1);
+            void update(layers::BasicLayer<T> &layer) override;
+            void update(BasicParameterArena<T> &arena) override;
+            int getStateCount() const override;
     };
-    class Adam : public Optimizer {
+    template <typename T>
+    class BasicAdam : public BasicOptimizer<T> {
         public:
-            Adam(double learningRate = 0.001, double beta1 = 0.9, double beta2 = 0.999, double epsilon = 1e-8);
-            void update(layers::Layer &layer) override;
+            BasicAdam(double learningRate = 0.001, double beta1 = 0.9, double beta2 = 0.999, double epsilon = 1e-8);
+            void update(layers::BasicLayer<T> &layer) override;
+            void update(BasicParameterArena<T> &arena) override;
+            int getStateCount() const override;
         private:
             double beta1;
             double beta2;
             double epsilon;
-            std::unordered_map<std::string, Matrix> m;
-            std::unordered_map<std::string, Matrix> v;
-            int t;
     };
-    class AdamW : public Optimizer {
+    template <typename T>
+    class BasicAdamW : public BasicOptimizer<T> {
         public:
-            AdamW(double learningRate = 0.001, double weightDecay = 0.01, double beta1 = 0.9, double beta2 = 0.999, double epsilon = 1e-8);
-            void update(layers::Layer &layer) override;
+            BasicAdamW(double learningRate = 0.001, double weightDecay = 0.01, double beta1 = 0.9, double beta2 = 0.999, double epsilon = 1e-8);
+            void update(layers::BasicLayer<T> &layer) override;
+            void update(BasicParameterArena<T> &arena) override;
+            int getStateCount() const override;
         private:
             double beta1;
             double beta2;
             double epsilon;
             double weightDecay;
-            std::unordered_map<std::string, Matrix> m;
-            std::unordered_map<std::string, Matrix> v;
-            int t;
     };
-    class AdaGrad : public Optimizer {
+    template <typename T>
+    class BasicAdaGrad : public BasicOptimizer<T> {
         public:
-            AdaGrad(double learningRate = 0.01, double epsilon = 1e-8);
-            void update(layers::Layer &layer) override;
+            BasicAdaGrad(double learningRate = 0.01, double epsilon = 1e-8);
+            void update(layers::BasicLayer<T> &layer) override;
+            void update(BasicParameterArena<T> &arena) override;
+            int getStateCount() const override;
         private:
             double epsilon;
-            std::unordered_map<std::string, Matrix> v;
     };
-    class RMSProp : public Optimizer {
+    template <typename T>
+    class BasicRMSProp : public BasicOptimizer<T> {
         public:
-            RMSProp(double learningRate = 0.01, double beta = 0.9, double epsilon = 1e-8);
-            void update(layers::Layer &layer) override;
+            BasicRMSProp(double learningRate = 0.01, double beta = 0.9, double epsilon = 1e-8);
+            void update(layers::BasicLayer<T> &layer) override;
+            void update(BasicParameterArena<T> &arena) override;
+            int getStateCount() const override;
         private:
             double beta;
             double epsilon;
-            std::unordered_map<std::string, Matrix> v;
     };
+
+    using Optimizer = BasicOptimizer<double>;
+    using SGD = BasicSGD<double>;
+    using Adam = BasicAdam<double>;
+    using AdamW = BasicAdamW<double>;
+    using AdaGrad = BasicAdaGrad<double>;
+    using RMSProp = BasicRMSProp<double>;
+
+    extern template class BasicOptimizer<double>;
+    extern template class BasicOptimizer<float>;
+    extern template class BasicSGD<double>;
+    extern template class BasicSGD<float>;
+    extern template class BasicAdam<double>;
+    extern template class BasicAdam<float>;
+    extern template class BasicAdamW<double>;
+    extern template class BasicAdamW<float>;
+    extern template class BasicAdaGrad<double>;
+    extern template class BasicAdaGrad<float>;
+    extern template class BasicRMSProp<double>;
+    extern template class BasicRMSProp<float>;
 }
 
 #endif
\ No newline at end of file
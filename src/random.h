@@ -0,0 +1,50 @@
+#ifndef RANDOM_H
+#define RANDOM_H
+
+#include <cstdint>
+#include <limits>
+
+namespace litenet::random {
+    // One step of splitmix64, used to expand a seed into generator state
+    inline uint64_t splitMix64(uint64_t &state) {
+        uint64_t z = (state += 0x9e3779b97f4a7c15);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+        return z ^ (z >> 31);
+    }
+
+    // xoshiro256** (Blackman and Vigna): a few cycles per 64-bit output and 32 bytes of state, so
+    // parallel code can give every fixed-size chunk of work its own generator. Generators with the same
+    // seed and different streams produce independent sequences. Satisfies UniformRandomBitGenerator.
+    class Xoshiro256 {
+        public:
+            using result_type = uint64_t;
+            explicit Xoshiro256(uint64_t seed, uint64_t stream = 0) {
+                uint64_t state = seed ^ (stream * 0xd1b54a32d192ed03);
+                splitMix64(state); // decorrelates nearby (seed, stream) pairs
+                for (uint64_t &word : s) {
+                    word = splitMix64(state);
+                }
+            }
+            uint64_t operator()() {
+                uint64_t result = rotl(s[1] * 5, 7) * 9;
+                uint64_t t = s[1] << 17;
+                s[2] ^= s[0];
+                s[3] ^= s[1];
+                s[1] ^= s[2];
+                s[0] ^= s[3];
+                s[2] ^= t;
+                s[3] = rotl(s[3], 45);
+                return result;
+            }
+            static constexpr uint64_t min() { return 0; }
+            static constexpr uint64_t max() { return std::numeric_limits<uint64_t>::max(); }
+        private:
+            static uint64_t rotl(uint64_t x, int k) {
+                return (x << k) | (x >> (64 - k));
+            }
+            uint64_t s[4];
+    };
+}
+
+#endif
\ No newline at end of file
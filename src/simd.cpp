@@ -0,0 +1,296 @@
+#include "simd.h"
+
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <stdexcept>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define LITENET_SIMD_X86
+#include <immintrin.h>
+// Vector types only cross function boundaries inside a single target region
+#pragma GCC diagnostic ignored "-Wpsabi"
+#endif
+
+// Each instruction set defines a V traits struct per scalar type and includes the shared kernel bodies
+// once in an f64 and once in an f32 namespace; tableFor picks the table by scalar type
+namespace litenet::simd {
+    namespace scalar {
+        constexpr const char *name = "scalar";
+        template <typename Scalar>
+        struct V {
+            using S = Scalar;
+            using T = Scalar;
+            static constexpr size_t W = 1;
+            static T load(const S *p) { return *p; }
+            static void store(S *p, T v) { *p = v; }
+            static T set1(S x) { return x; }
+            static T add(T a, T b) { return a + b; }
+            static T sub(T a, T b) { return a - b; }
+            static T mul(T a, T b) { return a * b; }
+            static T div(T a, T b) { return a / b; }
+            static T sqrt(T a) { return std::sqrt(a); }
+            static T abs(T a) { return std::abs(a); }
+            static T max(T a, T b) { return a > b ? a : b; }
+            static T min(T a, T b) { return a < b ? a : b; }
+            static T greaterSelect(T x, T y, T a, T b) { return x > y ? a : b; }
+            static S reduceAdd(T v) { return v; }
+            static S reduceMax(T v) { return v; }
+            static S reduceMin(T v) { return v; }
+        };
+        namespace f64 {
+            using V = scalar::V<double>;
+            #include "simd_kernels.inc"
+        }
+        namespace f32 {
+            using V = scalar::V<float>;
+            #include "simd_kernels.inc"
+        }
+        const Kernels<double> &tableFor(double) { return f64::table; }
+        const Kernels<float> &tableFor(float) { return f32::table; }
+    }
+
+#ifdef LITENET_SIMD_X86
+#pragma GCC push_options
+#pragma GCC target("sse2")
+    namespace sse2 {
+        constexpr const char *name = "sse2";
+        struct V64 {
+            using S = double;
+            using T = __m128d;
+            static constexpr size_t W = 2;
+            static T load(const S *p) { return _mm_loadu_pd(p); }
+            static void store(S *p, T v) { _mm_storeu_pd(p, v); }
+            static T set1(S x) { return _mm_set1_pd(x); }
+            static T add(T a, T b) { return _mm_add_pd(a, b); }
+            static T sub(T a, T b) { return _mm_sub_pd(a, b); }
+            static T mul(T a, T b) { return _mm_mul_pd(a, b); }
+            static T div(T a, T b) { return _mm_div_pd(a, b); }
+            static T sqrt(T a) { return _mm_sqrt_pd(a); }
+            static T abs(T a) { return _mm_andnot_pd(_mm_set1_pd(-0.0), a); }
+            static T max(T a, T b) { return _mm_max_pd(a, b); }
+            static T min(T a, T b) { return _mm_min_pd(a, b); }
+            static T greaterSelect(T x, T y, T a, T b) {
+                T mask = _mm_cmpgt_pd(x, y);
+                return _mm_or_pd(_mm_and_pd(mask, a), _mm_andnot_pd(mask, b));
+            }
+            static S reduceAdd(T v) { return _mm_cvtsd_f64(_mm_add_sd(v, _mm_unpackhi_pd(v, v))); }
+            static S reduceMax(T v) { return _mm_cvtsd_f64(_mm_max_sd(v, _mm_unpackhi_pd(v, v))); }
+            static S reduceMin(T v) { return _mm_cvtsd_f64(_mm_min_sd(v, _mm_unpackhi_pd(v, v))); }
+        };
+        struct V32 {
+            using S = float;
+            using T = __m128;
+            static constexpr size_t W = 4;
+            static T load(const S *p) { return _mm_loadu_ps(p); }
+            static void store(S *p, T v) { _mm_storeu_ps(p, v); }
+            static T set1(S x) { return _mm_set1_ps(x); }
+            static T add(T a, T b) { return _mm_add_ps(a, b); }
+            static T sub(T a, T b) { return _mm_sub_ps(a, b); }
+            static T mul(T a, T b) { return _mm_mul_ps(a, b); }
+            static T div(T a, T b) { return _mm_div_ps(a, b); }
+            static T sqrt(T a) { return _mm_sqrt_ps(a); }
+            static T abs(T a) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), a); }
+            static T max(T a, T b) { return _mm_max_ps(a, b); }
+            static T min(T a, T b) { return _mm_min_ps(a, b); }
+            static T greaterSelect(T x, T y, T a, T b) {
+                T mask = _mm_cmpgt_ps(x, y);
+                return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+            }
+            // Fold the upper half onto the lower half, then the second lane onto the first
+            static S reduceAdd(T v) {
+                v = _mm_add_ps(v, _mm_movehl_ps(v, v));
+                return _mm_cvtss_f32(_mm_add_ss(v, _mm_shuffle_ps(v, v, 1)));
+            }
+            static S reduceMax(T v) {
+                v = _mm_max_ps(v, _mm_movehl_ps(v, v));
+                return _mm_cvtss_f32(_mm_max_ss(v, _mm_shuffle_ps(v, v, 1)));
+            }
+            static S reduceMin(T v) {
+                v = _mm_min_ps(v, _mm_movehl_ps(v, v));
+                return _mm_cvtss_f32(_mm_min_ss(v, _mm_shuffle_ps(v, v, 1)));
+            }
+        };
+        namespace f64 {
+            using V = V64;
+            #include "simd_kernels.inc"
+        }
+        namespace f32 {
+            using V = V32;
+            #include "simd_kernels.inc"
+        }
+        const Kernels<double> &tableFor(double) { return f64::table; }
+        const Kernels<float> &tableFor(float) { return f32::table; }
+    }
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target("avx2")
+    namespace avx2 {
+        constexpr const char *name = "avx2";
+        struct V64 {
+            using S = double;
+            using T = __m256d;
+            static constexpr size_t W = 4;
+            static T load(const S *p) { return _mm256_loadu_pd(p); }
+            static void store(S *p, T v) { _mm256_storeu_pd(p, v); }
+            static T set1(S x) { return _mm256_set1_pd(x); }
+            static T add(T a, T b) { return _mm256_add_pd(a, b); }
+            static T sub(T a, T b) { return _mm256_sub_pd(a, b); }
+            static T mul(T a, T b) { return _mm256_mul_pd(a, b); }
+            static T div(T a, T b) { return _mm256_div_pd(a, b); }
+            static T sqrt(T a) { return _mm256_sqrt_pd(a); }
+            static T abs(T a) { return _mm256_andnot_pd(_mm256_set1_pd(-0.0), a); }
+            static T max(T a, T b) { return _mm256_max_pd(a, b); }
+            static T min(T a, T b) { return _mm256_min_pd(a, b); }
+            static T greaterSelect(T x, T y, T a, T b) { return _mm256_blendv_pd(b, a, _mm256_cmp_pd(x, y, _CMP_GT_OQ)); }
+            static S reduceAdd(T v) { return sse2::V64::reduceAdd(_mm_add_pd(_mm256_castpd256_pd128(v), _mm256_extractf128_pd(v, 1))); }
+            static S reduceMax(T v) { return sse2::V64::reduceMax(_mm_max_pd(_mm256_castpd256_pd128(v), _mm256_extractf128_pd(v, 1))); }
+            static S reduceMin(T v) { return sse2::V64::reduceMin(_mm_min_pd(_mm256_castpd256_pd128(v), _mm256_extractf128_pd(v, 1))); }
+        };
+        struct V32 {
+            using S = float;
+            using T = __m256;
+            static constexpr size_t W = 8;
+            static T load(const S *p) { return _mm256_loadu_ps(p); }
+            static void store(S *p, T v) { _mm256_storeu_ps(p, v); }
+            static T set1(S x) { return _mm256_set1_ps(x); }
+            static T add(T a, T b) { return _mm256_add_ps(a, b); }
+            static T sub(T a, T b) { return _mm256_sub_ps(a, b); }
+            static T mul(T a, T b) { return _mm256_mul_ps(a, b); }
+            static T div(T a, T b) { return _mm256_div_ps(a, b); }
+            static T sqrt(T a) { return _mm256_sqrt_ps(a); }
+            static T abs(T a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a); }
+            static T max(T a, T b) { return _mm256_max_ps(a, b); }
+            static T min(T a, T b) { return _mm256_min_ps(a, b); }
+            static T greaterSelect(T x, T y, T a, T b) { return _mm256_blendv_ps(b, a, _mm256_cmp_ps(x, y, _CMP_GT_OQ)); }
+            static S reduceAdd(T v) { return sse2::V32::reduceAdd(_mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1))); }
+            static S reduceMax(T v) { return sse2::V32::reduceMax(_mm_max_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1))); }
+            static S reduceMin(T v) { return sse2::V32::reduceMin(_mm_min_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1))); }
+        };
+        namespace f64 {
+            using V = V64;
+            #include "simd_kernels.inc"
+        }
+        namespace f32 {
+            using V = V32;
+            #include "simd_kernels.inc"
+        }
+        const Kernels<double> &tableFor(double) { return f64::table; }
+        const Kernels<float> &tableFor(float) { return f32::table; }
+    }
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target("avx512f")
+    namespace avx512 {
+        constexpr const char *name = "avx512";
+        struct V64 {
+            using S = double;
+            using T = __m512d;
+            static constexpr size_t W = 8;
+            static T load(const S *p) { return _mm512_loadu_pd(p); }
+            static void store(S *p, T v) { _mm512_storeu_pd(p, v); }
+            static T set1(S x) { return _mm512_set1_pd(x); }
+            static T add(T a, T b) { return _mm512_add_pd(a, b); }
+            static T sub(T a, T b) { return _mm512_sub_pd(a, b); }
+            static T mul(T a, T b) { return _mm512_mul_pd(a, b); }
+            static T div(T a, T b) { return _mm512_div_pd(a, b); }
+            static T sqrt(T a) { return _mm512_maskz_sqrt_pd(all, a); }
+            static T abs(T a) { return _mm512_abs_pd(a); }
+            static T max(T a, T b) { return _mm512_maskz_max_pd(all, a, b); }
+            static T min(T a, T b) { return _mm512_maskz_min_pd(all, a, b); }
+            static T greaterSelect(T x, T y, T a, T b) { return _mm512_mask_blend_pd(_mm512_cmp_pd_mask(x, y, _CMP_GT_OQ), b, a); }
+            static S reduceAdd(T v) { return avx2::V64::reduceAdd(_mm256_add_pd(low(v), high(v))); }
+            static S reduceMax(T v) { return avx2::V64::reduceMax(_mm256_max_pd(low(v), high(v))); }
+            static S reduceMin(T v) { return avx2::V64::reduceMin(_mm256_min_pd(low(v), high(v))); }
+            // The unmasked max, min, sqrt and extract intrinsics (and the casts to 256 bits, which extract) pass GCC
+            // an undefined source vector, which -Wall reports as uninitialized; their zero-masked forms with every
+            // lane selected do not
+            static constexpr __mmask8 all = 0xff;
+            static __m256d low(T v) { return _mm512_maskz_extractf64x4_pd(0xf, v, 0); }
+            static __m256d high(T v) { return _mm512_maskz_extractf64x4_pd(0xf, v, 1); }
+        };
+        struct V32 {
+            using S = float;
+            using T = __m512;
+            static constexpr size_t W = 16;
+            static T load(const S *p) { return _mm512_loadu_ps(p); }
+            static void store(S *p, T v) { _mm512_storeu_ps(p, v); }
+            static T set1(S x) { return _mm512_set1_ps(x); }
+            static T add(T a, T b) { return _mm512_add_ps(a, b); }
+            static T sub(T a, T b) { return _mm512_sub_ps(a, b); }
+            static T mul(T a, T b) { return _mm512_mul_ps(a, b); }
+            static T div(T a, T b) { return _mm512_div_ps(a, b); }
+            static T sqrt(T a) { return _mm512_maskz_sqrt_ps(all, a); }
+            static T abs(T a) { return _mm512_abs_ps(a); }
+            static T max(T a, T b) { return _mm512_maskz_max_ps(all, a, b); }
+            static T min(T a, T b) { return _mm512_maskz_min_ps(all, a, b); }
+            static T greaterSelect(T x, T y, T a, T b) { return _mm512_mask_blend_ps(_mm512_cmp_ps_mask(x, y, _CMP_GT_OQ), b, a); }
+            static S reduceAdd(T v) { return avx2::V32::reduceAdd(_mm256_add_ps(low(v), high(v))); }
+            static S reduceMax(T v) { return avx2::V32::reduceMax(_mm256_max_ps(low(v), high(v))); }
+            static S reduceMin(T v) { return avx2::V32::reduceMin(_mm256_min_ps(low(v), high(v))); }
+            static constexpr __mmask16 all = 0xffff;
+            static __m256 low(T v) { return _mm256_castpd_ps(_mm512_maskz_extractf64x4_pd(0xf, _mm512_castps_pd(v), 0)); }
+            static __m256 high(T v) { return _mm256_castpd_ps(_mm512_maskz_extractf64x4_pd(0xf, _mm512_castps_pd(v), 1)); }
+        };
+        namespace f64 {
+            using V = V64;
+            #include "simd_kernels.inc"
+        }
+        namespace f32 {
+            using V = V32;
+            #include "simd_kernels.inc"
+        }
+        const Kernels<double> &tableFor(double) { return f64::table; }
+        const Kernels<float> &tableFor(float) { return f32::table; }
+    }
+#pragma GCC pop_options
+#endif
+
+    namespace {
+        template <typename T>
+        const Kernels<T> &select() {
+            const char *cap = std::getenv("LITENET_SIMD");
+            std::string limit = cap ? cap : "";
+            if (!limit.empty() && limit != "avx512" && limit != "avx2" && limit != "sse2" && limit != "scalar") {
+                // a typo would otherwise select the scalar kernels without notice
+                throw std::invalid_argument("LITENET_SIMD must be avx512, avx2, sse2 or scalar, not " + limit);
+            }
+#ifdef LITENET_SIMD_X86
+            __builtin_cpu_init();
+            if (limit.empty() || limit == "avx512") {
+                if (__builtin_cpu_supports("avx512f")) {
+                    return avx512::tableFor(T());
+                }
+                limit.clear();
+            }
+            if (limit.empty() || limit == "avx2") {
+                if (__builtin_cpu_supports("avx2")) {
+                    return avx2::tableFor(T());
+                }
+                limit.clear();
+            }
+            if (limit.empty() || limit == "sse2") {
+                if (__builtin_cpu_supports("sse2")) {
+                    return sse2::tableFor(T());
+                }
+            }
+#endif
+            return scalar::tableFor(T());
+        }
+    }
+
+    template <>
+    const Kernels<double> &kernels<double>() {
+        static const Kernels<double> &selected = select<double>();
+        return selected;
+    }
+
+    template <>
+    const Kernels<float> &kernels<float>() {
+        static const Kernels<float> &selected = select<float>();
+        return selected;
+    }
+}
\ No newline at end of file
@@ -0,0 +1,52 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+#include <cstddef>
+
+// Compiles a function for AVX-512, AVX2 and the baseline instruction set; the loader picks the clone
+// matching the CPU. Used for loops the compiler vectorizes itself, such as fused expression evaluation.
+#if defined(__GNUC__) && defined(__x86_64__) && defined(__linux__)
+#define LITENET_TARGET_CLONES __attribute__((target_clones("avx512f", "avx2", "default")))
+#else
+#define LITENET_TARGET_CLONES
+#endif
+
+namespace litenet::simd {
+    // Element-wise and reduction kernels over contiguous arrays of n scalars (float or double)
+    // Outputs may alias inputs; reductions require n > 0
+    template <typename T>
+    struct Kernels {
+        const char *name;
+        void (*add)(const T *a, const T *b, T *out, size_t n);
+        void (*sub)(const T *a, const T *b, T *out, size_t n);
+        void (*mul)(const T *a, const T *b, T *out, size_t n);
+        void (*div)(const T *a, const T *b, T *out, size_t n);
+        void (*addScalar)(const T *a, T scalar, T *out, size_t n);
+        void (*subFromScalar)(T scalar, const T *a, T *out, size_t n);
+        void (*mulScalar)(const T *a, T scalar, T *out, size_t n);
+        void (*divScalar)(const T *a, T scalar, T *out, size_t n);
+        void (*square)(const T *a, T *out, size_t n);
+        void (*sqrt)(const T *a, T *out, size_t n);
+        void (*abs)(const T *a, T *out, size_t n);
+        void (*sign)(const T *a, T *out, size_t n);
+        void (*relu)(const T *a, T *out, size_t n);
+        void (*reluPrime)(const T *a, T *out, size_t n);
+        void (*leakyRelu)(const T *a, T negativeSlope, T *out, size_t n);
+        void (*leakyReluPrime)(const T *a, T negativeSlope, T *out, size_t n);
+        T (*sum)(const T *a, size_t n);
+        T (*max)(const T *a, size_t n);
+        T (*min)(const T *a, size_t n);
+    };
+
+    // Kernels for the widest instruction set supported by the CPU (AVX-512, AVX2, SSE2 or scalar),
+    // selected once on first use. Setting LITENET_SIMD to one of those names (avx512, avx2, sse2, scalar)
+    // caps the selection; any other value makes the first use throw std::invalid_argument
+    template <typename T>
+    const Kernels<T> &kernels();
+    template <>
+    const Kernels<double> &kernels<double>();
+    template <>
+    const Kernels<float> &kernels<float>();
+}
+
+#endif
\ No newline at end of file
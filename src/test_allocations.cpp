@@ -0,0 +1,134 @@
+#include "model.h"
+#include "layers.h"
+#include "optimizers.h"
+#include "memory.h"
+#include "threads.h"
+
+#include <iostream>
+#include <string>
+#include <memory>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+// Checks that steady-state training does not allocate: every call to operator new is counted, and so are
+// the pool's trips to the heap (memory::stats), between the optimizer steps of Model::fit after a warm-up
+
+namespace {
+    std::atomic<size_t> heapAllocations{0};
+}
+
+void *operator new(size_t bytes) {
+    heapAllocations.fetch_add(1, std::memory_order_relaxed);
+    if (void *p = std::malloc(bytes > 0 ? bytes : 1)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+// GCC sees the malloc in operator new through inlining and takes the free below for a mismatch
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+void operator delete(void *p) noexcept {
+    std::free(p);
+}
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+void operator delete(void *p, size_t) noexcept {
+    ::operator delete(p);
+}
+
+namespace {
+    constexpr int warmupSteps = 3; // first steps size the buffers, optimizer state and free lists
+
+    // Forwards to another optimizer and records the allocations made since the previous step
+    class CountingOptimizer : public litenet::optimizers::Optimizer {
+        public:
+            CountingOptimizer(std::unique_ptr<litenet::optimizers::Optimizer> inner) : litenet::optimizers::Optimizer(0), inner(std::move(inner)) {}
+            void update(litenet::layers::Layer &layer) override {
+                inner->update(layer);
+            }
+            void update(litenet::ParameterArena &arena) override {
+                inner->update(arena);
+                size_t now = heapAllocations.load(std::memory_order_relaxed);
+                steps++;
+                if (steps == warmupSteps) {
+                    litenet::memory::resetStats();
+                } else if (steps > warmupSteps) {
+                    steadyAllocations += now - last;
+                }
+                last = now;
+            }
+            int getStateCount() const override {
+                return inner->getStateCount();
+            }
+            int steps = 0;
+            size_t steadyAllocations = 0;
+        private:
+            std::unique_ptr<litenet::optimizers::Optimizer> inner;
+            size_t last = 0;
+    };
+
+    // Trains one epoch of model and reports the allocations of its steady-state steps; the epoch and fit
+    // setup (the prefetch thread, the index permutation) fall outside them
+    bool check(const std::string &name, litenet::Model &model, const std::string &loss, const litenet::Matrix &inputs, const litenet::Matrix &targets, int batchSize) {
+        auto counting = std::make_unique<CountingOptimizer>(std::make_unique<litenet::optimizers::Adam>(0.01));
+        CountingOptimizer *optimizer = counting.get();
+        model.compile(loss, std::move(counting));
+        std::streambuf *output = std::cout.rdbuf(nullptr); // silences the progress lines of fit
+        model.fit(inputs, targets, 1, batchSize);
+        std::cout.rdbuf(output);
+        size_t systemAllocations = litenet::memory::stats().systemAllocations;
+        bool passed = optimizer->steadyAllocations == 0 && systemAllocations == 0;
+        std::cout << (passed ? "PASS " : "FAIL ") << name << ": " << optimizer->steadyAllocations << " heap allocations and " << systemAllocations << " pool allocations from the heap in " << optimizer->steps - warmupSteps << " steady-state steps" << std::endl;
+        return passed;
+    }
+}
+
+int main() {
+    const int samples = 512;
+    const int batchSize = 32;
+    bool passed = true;
+
+    // Dense layers with a softmax output and categorical cross-entropy, which fit fuses
+    {
+        litenet::Matrix inputs(samples, 16);
+        litenet::Matrix targets(samples, 4);
+        for (int i = 0; i < samples; i++) {
+            for (int j = 0; j < 16; j++) {
+                inputs(i, j) = ((i * 31 + j * 7) % 17) / 17.0 + (i % 4 == j % 4);
+            }
+            targets(i, i % 4) = 1;
+        }
+        litenet::Model model(1);
+        model.add(std::make_unique<litenet::layers::Dense>(16, 32, "relu"));
+        model.add(std::make_unique<litenet::layers::Dense>(32, 4, "softmax"));
+        passed &= check("dense, fused softmax cross-entropy", model, "categorical_crossentropy", inputs, targets, batchSize);
+    }
+
+    // Embedding and LayerNormalization with class-id targets, trained data-parallel on two workers
+    {
+        litenet::threads::setNumThreads(2);
+        litenet::Matrix tokens(samples, 4);
+        litenet::Matrix labels(samples, 1);
+        for (int i = 0; i < samples; i++) {
+            for (int l = 0; l < 4; l++) {
+                tokens(i, l) = (i * 13 + l * 5) % 10;
+            }
+            labels(i, 0) = (i * 13) % 3;
+        }
+        litenet::Model model(2);
+        model.add(std::make_unique<litenet::layers::Embedding>(10, 8, 4));
+        model.add(std::make_unique<litenet::layers::Dense>(32, 16));
+        model.add(std::make_unique<litenet::layers::LayerNormalization>(16));
+        model.add(std::make_unique<litenet::layers::Dense>(16, 3, "softmax"));
+        model.setDataParallel(2);
+        passed &= check("embedding, layer normalization, data-parallel sparse cross-entropy", model, "sparse_categorical_crossentropy", tokens, labels, batchSize);
+    }
+
+    return passed ? 0 : 1;
+}
\ No newline at end of file
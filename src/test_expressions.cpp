@@ -0,0 +1,95 @@
+#include "matrix.h"
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <cmath>
+
+// Code written when the element-wise operators returned matrices must keep compiling and give the same
+// results now that they build lazy expressions: each check below is an idiom of that code
+
+namespace {
+    litenet::Matrix makeMatrix(int rows, int cols, double start) {
+        litenet::Matrix m(rows, cols);
+        for (int i = 0; i < rows; i++) {
+            for (int j = 0; j < cols; j++) {
+                m(i, j) = start + i * cols + j;
+            }
+        }
+        return m;
+    }
+
+    bool equal(const litenet::Matrix &a, const litenet::Matrix &b) {
+        if (a.getRows() != b.getRows() || a.getCols() != b.getCols()) {
+            return false;
+        }
+        for (int i = 0; i < a.getRows(); i++) {
+            for (int j = 0; j < a.getCols(); j++) {
+                if (a(i, j) != b(i, j)) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    std::string printed(const litenet::Matrix &m) {
+        std::ostringstream text;
+        std::streambuf *output = std::cout.rdbuf(text.rdbuf());
+        m.print();
+        std::cout.rdbuf(output);
+        return text.str();
+    }
+
+    bool report(const std::string &name, bool passed) {
+        std::cout << (passed ? "PASS " : "FAIL ") << name << std::endl;
+        return passed;
+    }
+}
+
+int main() {
+    litenet::Matrix a = makeMatrix(2, 3, 1);
+    litenet::Matrix b = makeMatrix(2, 3, -2.5);
+    litenet::Matrix c = makeMatrix(3, 2, 0.5);
+    litenet::Matrix sum = a;
+    sum += b;
+    litenet::Matrix difference = a;
+    difference -= b;
+    bool passed = true;
+
+    passed &= report("(a + b).transpose()", equal((a + b).transpose(), sum.transpose()));
+    passed &= report("(a + b)(i, j)", (a + b)(1, 2) == sum(1, 2) && (a / b)(0, 1) == a(0, 1) / b(0, 1));
+    passed &= report("(a - b).sum(axis), max(axis), min(axis)", equal((a - b).sum(0), difference.sum(0)) && equal((a - b).max(1), difference.max(1)) && equal((a - b).min(0), difference.min(0)));
+    litenet::Matrix doubled = a;
+    doubled *= 2.0;
+    std::ostringstream text;
+    std::streambuf *output = std::cout.rdbuf(text.rdbuf());
+    (a * 2.0).print();
+    std::cout.rdbuf(output);
+    passed &= report("(a * 2.0).print()", text.str() == printed(doubled));
+    passed &= report("(a + b).flatten()", (a + b).flatten() == sum.flatten());
+    passed &= report("(a + b).getRows(), getCols(), getShape()", (a + b).getRows() == 2 && (a + b).getCols() == 3 && (a + b).getShape() == sum.getShape());
+    passed &= report("(a + b).subsetRows(), subsetCols(), normalize()", equal((a + b).subsetRows(1, 1), sum.subsetRows(1, 1)) && equal((a + b).subsetCols(0, 1), sum.subsetCols(0, 1)) && equal((a * 1.0).normalize(), a.normalize()));
+    passed &= report("(a + b) * c, a + b == sum", equal((a + b) * c, sum * c) && a + b == sum && a - b != sum);
+
+    bool choices[] = {true, false};
+    bool ternary = true;
+    for (bool choice : choices) {
+        litenet::Matrix chosen = choice ? a + b : a - b;
+        litenet::Matrix scaled = choice ? a * 2.0 : a + 1.0;
+        ternary &= equal(chosen, choice ? sum : difference) && scaled(1, 1) == (choice ? a(1, 1) * 2 : a(1, 1) + 1);
+    }
+    passed &= report("cond ? a + b : a - b", ternary);
+
+    // Temporaries are moved into the expression, so auto results stay valid after the statement
+    auto fromTemporary = makeMatrix(2, 3, 1) + b;
+    auto fromTemporaries = (makeMatrix(2, 3, 1) - makeMatrix(2, 3, -2.5)).sqrt();
+    auto scaledTemporary = 2.0 * makeMatrix(2, 3, 1);
+    makeMatrix(2, 3, 100); // reuses the freed storage of the temporaries, if any had been kept by reference
+    litenet::Matrix root = difference;
+    root.applyInPlace([](double x) { return std::sqrt(x); });
+    passed &= report("auto r = makeMatrix() + b", equal(fromTemporary, sum) && equal(fromTemporaries, root) && equal(scaledTemporary, doubled));
+
+    return passed ? 0 : 1;
+}
\ No newline at end of file
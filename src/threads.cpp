@@ -0,0 +1,235 @@
+#include "threads.h"
+
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <cstdlib>
+#include <algorithm>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace litenet::threads {
+    namespace {
+        // A participant's share of the chunks of a job: the owner takes chunks from the front, thieves from
+        // the back. Both ends are packed in one word (front in the high half) so either move is a single CAS.
+        struct alignas(64) Share {
+            std::atomic<uint64_t> bounds{0};
+        };
+
+        uint64_t pack(uint64_t front, uint64_t back) {
+            return (front << 32) | back;
+        }
+
+        bool take(Share &share, size_t &index) {
+            uint64_t bounds = share.bounds.load(std::memory_order_relaxed);
+            while (true) {
+                uint64_t front = bounds >> 32;
+                uint64_t back = bounds & 0xffffffff;
+                if (front >= back) {
+                    return false;
+                }
+                if (share.bounds.compare_exchange_weak(bounds, pack(front + 1, back), std::memory_order_acquire, std::memory_order_relaxed)) {
+                    index = front;
+                    return true;
+                }
+            }
+        }
+
+        bool steal(Share &share, size_t &index) {
+            uint64_t bounds = share.bounds.load(std::memory_order_relaxed);
+            while (true) {
+                uint64_t front = bounds >> 32;
+                uint64_t back = bounds & 0xffffffff;
+                if (front >= back) {
+                    return false;
+                }
+                if (share.bounds.compare_exchange_weak(bounds, pack(front, back - 1), std::memory_order_acquire, std::memory_order_relaxed)) {
+                    index = back - 1;
+                    return true;
+                }
+            }
+        }
+
+        thread_local bool insideWorker = false;
+        thread_local bool serialThread = false;
+
+        class Pool {
+            public:
+                Pool(int numThreads, bool pin);
+                ~Pool();
+                int size() const { return numThreads; }
+                void run(size_t n, size_t chunk, detail::ChunkFunction function, const void *context);
+            private:
+                void work(int index);
+                void participate(int index);
+                int numThreads;
+                std::vector<std::thread> workers;
+                std::unique_ptr<Share[]> shares;
+                // The current job; written by the submitting thread before the shares are published
+                detail::ChunkFunction function = nullptr;
+                const void *context = nullptr;
+                size_t n = 0;
+                size_t chunk = 1;
+                std::atomic<size_t> completed{0};
+                std::mutex submit; // one job at a time
+                std::mutex mutex;
+                std::condition_variable wake;
+                std::atomic<uint64_t> generation{0};
+                std::atomic<bool> stop{false};
+        };
+
+        Pool::Pool(int numThreads, bool pin) : numThreads(numThreads), shares(new Share[numThreads]) {
+            for (int i = 1; i < numThreads; i++) {
+                workers.emplace_back(&Pool::work, this, i);
+#if defined(__linux__)
+                if (pin) {
+                    cpu_set_t cpus;
+                    CPU_ZERO(&cpus);
+                    CPU_SET(i % CPU_SETSIZE, &cpus);
+                    pthread_setaffinity_np(workers.back().native_handle(), sizeof(cpus), &cpus);
+                }
+#endif
+            }
+        }
+
+        Pool::~Pool() {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stop = true;
+            }
+            wake.notify_all();
+            for (std::thread &worker : workers) {
+                worker.join();
+            }
+        }
+
+        void Pool::run(size_t n, size_t chunk, detail::ChunkFunction function, const void *context) {
+            size_t numChunks = (n + chunk - 1) / chunk;
+            bool serial = numThreads == 1 || insideWorker || serialThread || numChunks > 0xffffffff;
+            std::unique_lock<std::mutex> lock(submit, std::defer_lock);
+            if (serial || !lock.try_lock()) { // flags first: a nested call must not lock a mutex its thread holds
+                for (size_t begin = 0; begin < n; begin += chunk) {
+                    function(context, begin, std::min(n, begin + chunk));
+                }
+                return;
+            }
+            this->function = function;
+            this->context = context;
+            this->n = n;
+            this->chunk = chunk;
+            completed.store(0, std::memory_order_relaxed);
+            for (int i = 0; i < numThreads; i++) { // contiguous shares of (almost) equal size
+                shares[i].bounds.store(pack(numChunks * i / numThreads, numChunks * (i + 1) / numThreads), std::memory_order_release);
+            }
+            {
+                std::lock_guard<std::mutex> guard(mutex);
+                generation.fetch_add(1, std::memory_order_release);
+            }
+            wake.notify_all();
+
+            // The caller works on share 0, then waits for the chunks claimed by workers to finish.
+            // Workers that wake up after the last chunk was claimed find nothing left and go back to sleep
+            // Work nested in the chunks runs on the calling thread, as it does on the workers
+            insideWorker = true;
+            participate(0);
+            insideWorker = false;
+            while (completed.load(std::memory_order_acquire) != numChunks) {
+                std::this_thread::yield();
+            }
+        }
+
+        void Pool::participate(int index) {
+            size_t c;
+            auto execute = [this](size_t c) {
+                size_t begin = c * chunk;
+                function(context, begin, std::min(n, begin + chunk));
+                completed.fetch_add(1, std::memory_order_release);
+            };
+            while (take(shares[index], c)) {
+                execute(c);
+            }
+            for (int k = 1; k < numThreads; k++) {
+                Share &victim = shares[(index + k) % numThreads];
+                while (steal(victim, c)) {
+                    execute(c);
+                }
+            }
+        }
+
+        void Pool::work(int index) {
+            insideWorker = true;
+            uint64_t seen = 0;
+            while (true) {
+                // Spin briefly for the next job, since operations usually come back to back, then sleep
+                for (int spin = 0; spin < 1000 && generation.load(std::memory_order_acquire) == seen && !stop; spin++) {
+                    std::this_thread::yield();
+                }
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    wake.wait(lock, [&] { return stop || generation.load(std::memory_order_relaxed) != seen; });
+                    if (stop) {
+                        return;
+                    }
+                    seen = generation.load(std::memory_order_relaxed);
+                }
+                participate(index);
+            }
+        }
+
+        std::mutex configure;
+        std::unique_ptr<Pool> pool;
+        std::atomic<Pool *> current{nullptr};
+
+        int defaultNumThreads() {
+            if (const char *env = std::getenv("LITENET_NUM_THREADS")) {
+                int n = std::atoi(env);
+                if (n > 0) {
+                    return n;
+                }
+            }
+            return std::max(1u, std::thread::hardware_concurrency());
+        }
+
+        Pool &instance() {
+            Pool *p = current.load(std::memory_order_acquire);
+            if (!p) {
+                std::lock_guard<std::mutex> lock(configure);
+                if (!pool) {
+                    pool = std::make_unique<Pool>(defaultNumThreads(), false);
+                    current.store(pool.get(), std::memory_order_release);
+                }
+                p = pool.get();
+            }
+            return *p;
+        }
+    }
+
+    void setNumThreads(int n, bool pin) {
+        std::lock_guard<std::mutex> lock(configure);
+        current.store(nullptr, std::memory_order_release);
+        pool.reset();
+        pool = std::make_unique<Pool>(std::max(1, n), pin);
+        current.store(pool.get(), std::memory_order_release);
+    }
+
+    int getNumThreads() {
+        return instance().size();
+    }
+
+    void setThreadSerial(bool serial) {
+        serialThread = serial;
+    }
+
+    namespace detail {
+        void run(size_t n, size_t chunk, ChunkFunction function, const void *context) {
+            instance().run(n, chunk, function, context);
+        }
+    }
+}
\ No newline at end of file
@@ -0,0 +1,67 @@
+#ifndef THREADS_H
+#define THREADS_H
+
+#include <cstddef>
+
+// Library-wide thread pool
+//
+// Parallel operations split their index range into fixed-size chunks. Each participating thread (the
+// caller and the pool's workers) starts on its own contiguous share of the chunks and, once that runs
+// out, steals chunks from the back of the other shares. Work that fits in a single chunk, calls made
+// from inside a worker or a serial thread, and calls made while another thread is using the pool run on
+// the calling thread.
+namespace litenet::threads {
+    // Number of threads used by parallel operations, including the calling thread. Defaults to
+    // LITENET_NUM_THREADS if set, otherwise to the number of hardware threads. With pin, worker i is
+    // bound to CPU i + 1 (Linux only). Must not be called while parallel work is running.
+    void setNumThreads(int n, bool pin = false);
+    int getNumThreads();
+    // With serial, parallel operations called from this thread run on it alone. Background threads use this
+    // so that their work never holds the pool while the main thread's work waits for it
+    void setThreadSerial(bool serial);
+
+    // Default chunk size, in elements, for element-wise work; smaller operations stay on the calling thread
+    constexpr size_t grain = 1 << 15;
+
+    namespace detail {
+        using ChunkFunction = void (*)(const void *context, size_t begin, size_t end);
+        void run(size_t n, size_t chunk, ChunkFunction function, const void *context);
+    }
+
+    // Calls f(begin, end) for the chunks [0, chunk), [chunk, 2 * chunk), ... of [0, n), in parallel when
+    // there is more than one chunk. Chunk boundaries depend only on n and chunk, not on the thread count,
+    // so reductions that combine per-chunk partial results give the same answer on any machine.
+    // f must not throw.
+    template <typename F>
+    void parallelFor(size_t n, size_t chunk, const F &f) {
+        if (n <= chunk) {
+            if (n > 0) {
+                f(size_t(0), n);
+            }
+            return;
+        }
+        detail::run(n, chunk, [](const void *context, size_t begin, size_t end) {
+            (*static_cast<const F *>(context))(begin, end);
+        }, &f);
+    }
+
+    // Calls f(i) for each row i of a rows x cols operation, in chunks of about grain elements
+    template <typename F>
+    void parallelForRows(int rows, int cols, const F &f) {
+        size_t rowsPerChunk = cols > 0 && static_cast<size_t>(cols) < grain ? grain / cols : 1;
+        parallelFor(rows, rowsPerChunk, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) {
+                f(static_cast<int>(i));
+            }
+        });
+    }
+
+    // Chunk size for a reduction over n elements: at least grain, and at most maxChunks chunks
+    constexpr size_t maxChunks = 64;
+    inline size_t reductionChunk(size_t n) {
+        size_t chunk = (n + maxChunks - 1) / maxChunks;
+        return chunk < grain ? grain : chunk;
+    }
+}
+
+#endif
\ No newline at end of file